@@ -1,5 +0,0 @@
-#pragma once
-
-#include <stdint.h>
-
-void bleed_apply(uint8_t *image, int width, int height);
@@ -1,6 +1,9 @@
 
 #include "InputParser.h"
 #include "globbing.h"
+#include "caching.h"
+#include "stats.h"
+#include "ThreadPool.h"
 #include <charconv>
 #include <algorithm>
 #include <sstream>
@@ -108,39 +111,87 @@ TexturePtr InputParser::get_texture(const State& state) {
       state.duplicates,
       state.alpha,
       state.alpha_colorkey,
+      state.alpha_bleed_radius,
       state.pack,
     });
   }
   return texture;
 }
 
-ImagePtr InputParser::get_sheet(const std::filesystem::path& path,
+Sheet& InputParser::get_sheet_entry(const std::filesystem::path& path,
     const std::filesystem::path& filename, RGBA colorkey) {
-  auto& sheet = m_sheets[std::filesystem::weakly_canonical(path / filename)];
-  if (!sheet) {
-    auto image = Image(path, filename);
-
-    if (colorkey != RGBA{ }) {
-      if (!colorkey.a)
-        colorkey = guess_colorkey(image);
-      replace_color(image, colorkey, RGBA{ });
-    }
-
-    sheet = std::make_shared<Image>(std::move(image));
+  const auto key = std::filesystem::weakly_canonical(path / filename);
+  auto lock = std::lock_guard(m_sheets_mutex);
+  m_context.dependencies.insert(key);
+  auto& sheet = m_context.sheets[key];
+  if (!sheet.image || sheet.colorkey != colorkey) {
+    // only the size is read immediately, pixels are decoded in background
+    auto image = std::make_shared<Image>(path, filename, true);
+    sheet.image = image;
+    sheet.colorkey = colorkey;
+    sheet.occupancy = { };
+    auto load = [image, colorkey, cache_path = m_settings.cache_path]() {
+      auto scope = StageScope(Stage::decode, path_to_utf8(image->filename()));
+      const auto decode = [&](Image& sheet_image) {
+        if (stats_enabled()) {
+          auto error = std::error_code{ };
+          const auto size = std::filesystem::file_size(
+            sheet_image.path() / sheet_image.filename(), error);
+          add_bytes_read(error ? 0 : size);
+        }
+        sheet_image.load();
+        if (colorkey != RGBA{ })
+          replace_color(sheet_image, (colorkey.a ? colorkey :
+            guess_colorkey(sheet_image)), RGBA{ });
+      };
+      if (!cache_path.empty())
+        load_cached_image(cache_path, *image, colorkey, decode);
+      else
+        decode(*image);
+    };
+    // when caching or watching, sheets are only decoded when their sprites
+    // are not cached
+    sheet.loaded = (m_settings.cache_path.empty() && !m_settings.watch ?
+      thread_pool().async(std::move(load)) :
+      std::async(std::launch::deferred, std::move(load))).share();
   }
   return sheet;
 }
 
-ImagePtr InputParser::get_sheet(const State& state, int index) {
-  return get_sheet(state.path,
+Sheet& InputParser::get_sheet_entry(const State& state, int index) {
+  return get_sheet_entry(state.path,
     utf8_to_path(state.sheet.get_nth_filename(index)),
     state.colorkey);
 }
 
+ImagePtr InputParser::get_sheet(const State& state, int index) {
+  return get_sheet_entry(state, index).image;
+}
+
 ImagePtr InputParser::get_sheet(const State& state) {
   return get_sheet(state, m_current_sequence_index);
 }
 
+ImagePtr InputParser::get_loaded_sheet(const State& state) {
+  const auto& sheet = get_sheet_entry(state, m_current_sequence_index);
+  thread_pool().wait(sheet.loaded);
+  sheet.loaded.get();
+  return sheet.image;
+}
+
+OccupancyPtr InputParser::get_sheet_occupancy(const State& state) {
+  const auto sheet = get_loaded_sheet(state);
+  auto& entry = get_sheet_entry(state, m_current_sequence_index);
+  auto lock = std::lock_guard(m_sheets_mutex);
+  auto& occupancy = entry.occupancy;
+  if (!occupancy ||
+      occupancy->gray_levels() != state.trim_gray_levels ||
+      occupancy->threshold() != state.trim_threshold)
+    occupancy = std::make_shared<OccupancyIndex>(*sheet,
+      state.trim_gray_levels, state.trim_threshold);
+  return occupancy;
+}
+
 void InputParser::sprite_ends(State& state) {
   check(!state.sheet.empty(), "sprite not on sheet");
 
@@ -159,7 +210,14 @@ void InputParser::sprite_ends(State& state) {
   sprite.index = static_cast<int>(m_sprites.size());
   sprite.id = get_sprite_id(state);
   sprite.texture = get_texture(state);
-  sprite.source = get_sheet(state);
+  const auto& sheet = get_sheet_entry(state, m_current_sequence_index);
+  sprite.source = sheet.image;
+  sprite.source_loaded = sheet.loaded;
+  sprite.source_colorkey = sheet.colorkey;
+  if (sheet.occupancy &&
+      sheet.occupancy->gray_levels() == state.trim_gray_levels &&
+      sheet.occupancy->threshold() == state.trim_threshold)
+    sprite.source_occupancy = sheet.occupancy;
   sprite.source_rect = (!empty(state.rect) ?
     state.rect : sprite.source->bounds());
   sprite.pivot = state.pivot;
@@ -168,6 +226,7 @@ void InputParser::sprite_ends(State& state) {
   sprite.trim_margin = state.trim_margin;
   sprite.trim_threshold = state.trim_threshold;
   sprite.trim_gray_levels = state.trim_gray_levels;
+  sprite.trim_max_vertices = state.trim_max_vertices;
   sprite.crop = state.crop;
   sprite.extrude = state.extrude;
   sprite.common_divisor = state.common_divisor;
@@ -196,6 +255,15 @@ void InputParser::validate_sprite(const Sprite& sprite) {
 }
 
 void InputParser::deduce_globbing_sheets(State& state) {
+  // files added to the directory should be found in watch mode
+  auto directory = (state.path.empty() ? "." : state.path);
+  for (const auto& part : utf8_to_path(state.sheet.filename()).parent_path()) {
+    if (is_globbing_pattern(path_to_utf8(part)))
+      break;
+    directory /= part;
+  }
+  m_context.dependencies.insert(std::filesystem::weakly_canonical(directory));
+
   for (const auto& filename : glob_sequences(state.path, state.sheet.filename())) {
     state.sheet = filename;
     sheet_ends(state);
@@ -205,6 +273,8 @@ void InputParser::deduce_globbing_sheets(State& state) {
 void InputParser::deduce_sequence_sprites(State& state) {
   auto error = std::error_code{ };
   if (state.sheet.is_infinite_sequence()) {
+    m_context.dependencies.insert(std::filesystem::weakly_canonical(
+      (state.path / state.sheet.get_nth_filename(0)).parent_path()));
     for (auto i = 0; ; ++i)
       if (!std::filesystem::exists(state.path / state.sheet.get_nth_filename(i), error)) {
         state.sheet.set_count(i);
@@ -222,8 +292,11 @@ void InputParser::deduce_sequence_sprites(State& state) {
 }
 
 void InputParser::deduce_grid_sprites(State& state) {
-  const auto sheet = get_sheet(state);
-  const auto bounds = get_used_bounds(*sheet, state.trim_gray_levels);
+  // the cells are classified using an index of the sheet, which is
+  // also used for trimming the sprites
+  const auto sheet = get_loaded_sheet(state);
+  const auto occupancy = get_sheet_occupancy(state);
+  const auto bounds = occupancy->get_used_bounds();
 
   auto grid = state.grid;
   grid.x += state.grid_spacing.x;
@@ -245,9 +318,7 @@ void InputParser::deduce_grid_sprites(State& state) {
         state.grid.x, state.grid.y
       };
 
-      if (state.trim_gray_levels ?
-          is_fully_black(*sheet, state.trim_threshold, state.rect) :
-          is_fully_transparent(*sheet, state.trim_threshold, state.rect)) {
+      if (occupancy->is_unused(state.rect)) {
         ++skipped;
         continue;
       }
@@ -276,9 +347,11 @@ void InputParser::deduce_grid_sprites(State& state) {
 }
 
 void InputParser::deduce_atlas_sprites(State& state) {
-  const auto sheet = get_sheet(state);
-  for (const auto& rect : find_islands(*sheet,
-      state.atlas_merge_distance, state.trim_gray_levels)) {
+  const auto sheet = get_loaded_sheet(state);
+  // an index of the sheet is reused, when it was already built
+  const auto occupancy = get_sheet_entry(state, m_current_sequence_index).occupancy;
+  for (const auto& rect : find_islands(*sheet, state.atlas_merge_distance,
+      state.trim_gray_levels, { }, occupancy.get())) {
     if (m_settings.autocomplete) {
       auto& os = m_autocomplete_output;
       os << state.indent << "sprite \n";
@@ -447,12 +520,14 @@ void InputParser::apply_definition(State& state,
 
       if (state.alpha == Alpha::colorkey)
         state.alpha_colorkey = check_color();
+      if (state.alpha == Alpha::bleed)
+        state.alpha_bleed_radius = (arguments_left() ? check_uint() : 0);
       break;
     }
 
     case Definition::pack: {
       const auto string = check_string();
-      if (const auto index = index_of(string, { "binpack", "compact", "single", "keep" }); index >= 0)
+      if (const auto index = index_of(string, { "binpack", "compact", "single", "keep", "best" }); index >= 0)
         state.pack = static_cast<Pack>(index);
       else
         error("invalid pack method '" + std::string(string) + "'");
@@ -547,10 +622,15 @@ void InputParser::apply_definition(State& state,
 
     case Definition::trim: {
       const auto string = check_string();
-      if (const auto index = index_of(string, { "none", "rect", "convex" }); index >= 0)
+      if (const auto index = index_of(string, { "none", "rect", "convex", "mesh" }); index >= 0)
         state.trim = static_cast<Trim>(index);
       else
         error("invalid trim value '" + std::string(string) + "'");
+
+      if (state.trim == Trim::mesh) {
+        state.trim_max_vertices = (arguments_left() ? check_uint() : 16);
+        check(state.trim_max_vertices >= 4, "invalid vertex count");
+      }
       break;
     }
 
@@ -611,8 +691,9 @@ void InputParser::scope_ends(State& state) {
   }
 }
 
-InputParser::InputParser(const Settings& settings)
-  : m_settings(settings) {
+InputParser::InputParser(const Settings& settings, InputContext* context)
+  : m_settings(settings),
+    m_context(context ? *context : m_own_context) {
 }
 
 void InputParser::parse(std::istream& input) {
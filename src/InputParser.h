@@ -3,6 +3,8 @@
 #include "input.h"
 #include "FilenameSequence.h"
 #include <sstream>
+#include <future>
+#include <mutex>
 
 namespace spright {
 
@@ -69,6 +71,7 @@ struct State {
   Duplicates duplicates{ };
   Alpha alpha{ };
   RGBA alpha_colorkey{ };
+  int alpha_bleed_radius{ };
   Pack pack{ };
 
   std::filesystem::path path;
@@ -88,6 +91,7 @@ struct State {
   int trim_threshold{ 1 };
   int trim_margin{ };
   bool trim_gray_levels{ };
+  int trim_max_vertices{ };
   bool crop{ };
   int extrude{ };
   Size common_divisor{ 1, 1 };
@@ -95,7 +99,8 @@ struct State {
 
 class InputParser {
 public:
-  explicit InputParser(const Settings& settings);
+  explicit InputParser(const Settings& settings,
+    InputContext* context = nullptr);
   void parse(std::istream& input);
   const std::vector<Sprite>& sprites() const & { return m_sprites; }
   std::vector<Sprite> sprites() && { return std::move(m_sprites); }
@@ -106,10 +111,13 @@ private:
   void check(bool condition, std::string_view message);
   std::string get_sprite_id(const State& state) const;
   TexturePtr get_texture(const State& state);
+  Sheet& get_sheet_entry(const std::filesystem::path& path,
+    const std::filesystem::path& filename, RGBA colorkey);
+  Sheet& get_sheet_entry(const State& state, int index);
   ImagePtr get_sheet(const State& state);
   ImagePtr get_sheet(const State& state, int index);
-  ImagePtr get_sheet(const std::filesystem::path& path,
-    const std::filesystem::path& filename, RGBA colorkey);
+  ImagePtr get_loaded_sheet(const State& state);
+  OccupancyPtr get_sheet_occupancy(const State& state);
   void sprite_ends(State& state);
   void deduce_globbing_sheets(State& state);
   void deduce_sequence_sprites(State& state);
@@ -125,11 +133,13 @@ private:
   void scope_ends(State& state);
   void validate_sprite(const Sprite& sprite);
 
-  const Settings& m_settings;
+  const Settings m_settings;
+  InputContext m_own_context;
+  InputContext& m_context;
   std::stringstream m_autocomplete_output;
   int m_line_number{ };
   std::map<std::filesystem::path, TexturePtr> m_textures;
-  std::map<std::filesystem::path, ImagePtr> m_sheets;
+  std::mutex m_sheets_mutex;
   std::vector<Sprite> m_sprites;
   int m_sprites_in_current_sheet{ };
   int m_current_grid_cell_x{ };
@@ -0,0 +1,180 @@
+
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace spright {
+
+namespace {
+  thread_local const ThreadPool* t_current_pool;
+  thread_local size_t t_current_queue;
+
+  std::mutex s_thread_pool_mutex;
+  std::unique_ptr<ThreadPool> s_thread_pool;
+
+  int get_default_thread_count() {
+    return std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+  }
+} // namespace
+
+ThreadPool::ThreadPool(int thread_count) {
+  thread_count = std::max(thread_count, 1);
+  for (auto i = 0; i < thread_count; ++i)
+    m_queues.push_back(std::make_unique<Queue>());
+  for (auto i = 1; i < thread_count; ++i)
+    m_threads.emplace_back(&ThreadPool::thread_func, this, static_cast<size_t>(i));
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    auto lock = std::lock_guard(m_mutex);
+    m_shutdown = true;
+  }
+  m_condition.notify_all();
+  for (auto& thread : m_threads)
+    thread.join();
+}
+
+void ThreadPool::thread_func(size_t index) {
+  t_current_pool = this;
+  t_current_queue = index;
+  for (;;) {
+    if (run_pending_task())
+      continue;
+
+    auto lock = std::unique_lock(m_mutex);
+    m_condition.wait(lock, [&]() { return (m_shutdown || m_pending > 0); });
+    if (m_shutdown && m_pending == 0)
+      return;
+  }
+}
+
+void ThreadPool::post(Task task) {
+  auto& queue = *m_queues[t_current_pool == this ? t_current_queue : 0];
+  {
+    auto queue_lock = std::lock_guard(queue.mutex);
+    queue.tasks.push_back(std::move(task));
+    auto lock = std::lock_guard(m_mutex);
+    ++m_pending;
+  }
+  m_condition.notify_one();
+}
+
+bool ThreadPool::pop_task(Queue& queue, Task& task) {
+  auto lock = std::lock_guard(queue.mutex);
+  if (queue.tasks.empty())
+    return false;
+  task = std::move(queue.tasks.front());
+  queue.tasks.pop_front();
+  --m_pending;
+  return true;
+}
+
+bool ThreadPool::run_pending_task() {
+  if (m_pending == 0)
+    return false;
+
+  // take from own queue first, then steal from the others
+  const auto own = (t_current_pool == this ? t_current_queue : 0);
+  auto task = Task();
+  for (auto i = size_t{ }; i < m_queues.size(); ++i)
+    if (pop_task(*m_queues[(own + i) % m_queues.size()], task)) {
+      task();
+      notify_waiting();
+      return true;
+    }
+  return false;
+}
+
+void ThreadPool::notify_waiting() {
+  if (m_waiting > 0) {
+    { auto lock = std::lock_guard(m_mutex); }
+    m_condition.notify_all();
+  }
+}
+
+void ThreadPool::wait_until(const std::function<bool()>& done) {
+  ++m_waiting;
+  while (!done()) {
+    if (run_pending_task())
+      continue;
+
+    auto lock = std::unique_lock(m_mutex);
+    m_condition.wait(lock, [&]() { return (m_pending > 0 || done()); });
+  }
+  --m_waiting;
+}
+
+void ThreadPool::for_each(size_t count, const std::function<void(size_t)>& func) {
+  if (count == 0)
+    return;
+
+  if (count == 1 || m_threads.empty()) {
+    for (auto i = size_t{ }; i < count; ++i)
+      func(i);
+    return;
+  }
+
+  // indices are claimed in order, so callers can put the biggest items first.
+  // when more than one fails, the exception of the lowest index is rethrown.
+  struct State {
+    const std::function<void(size_t)>* func;
+    size_t count;
+    std::atomic<size_t> next{ };
+    std::atomic<size_t> done{ };
+    std::mutex mutex;
+    size_t error_index;
+    std::exception_ptr error;
+  };
+  const auto state = std::make_shared<State>();
+  state->func = &func;
+  state->count = count;
+  state->error_index = count;
+
+  const auto run = [state]() {
+    for (;;) {
+      const auto index = state->next++;
+      if (index >= state->count)
+        return;
+      try {
+        (*state->func)(index);
+      }
+      catch (...) {
+        auto lock = std::lock_guard(state->mutex);
+        if (index < state->error_index) {
+          state->error_index = index;
+          state->error = std::current_exception();
+        }
+      }
+      ++state->done;
+    }
+  };
+
+  const auto helpers = std::min(count, static_cast<size_t>(thread_count())) - 1;
+  for (auto i = size_t{ }; i < helpers; ++i)
+    post(run);
+  run();
+  wait_until([&]() { return (state->done == count); });
+
+  if (state->error)
+    std::rethrow_exception(state->error);
+}
+
+void set_thread_pool_size(int thread_count) {
+  if (thread_count <= 0)
+    thread_count = get_default_thread_count();
+
+  auto lock = std::lock_guard(s_thread_pool_mutex);
+  if (!s_thread_pool || s_thread_pool->thread_count() != thread_count) {
+    s_thread_pool.reset();
+    s_thread_pool = std::make_unique<ThreadPool>(thread_count);
+  }
+}
+
+ThreadPool& thread_pool() {
+  auto lock = std::lock_guard(s_thread_pool_mutex);
+  if (!s_thread_pool)
+    s_thread_pool = std::make_unique<ThreadPool>(get_default_thread_count());
+  return *s_thread_pool;
+}
+
+} // namespace
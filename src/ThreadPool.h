@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace spright {
+
+// work-stealing thread pool, with a fixed number of concurrently running jobs.
+// threads waiting for tasks help executing pending tasks, so no more than
+// thread_count() threads are busy and nested parallelism does not deadlock.
+class ThreadPool {
+public:
+  using Task = std::function<void()>;
+
+  explicit ThreadPool(int thread_count);
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  ~ThreadPool();
+
+  int thread_count() const { return static_cast<int>(m_threads.size()) + 1; }
+  void post(Task task);
+  bool run_pending_task();
+  void wait_until(const std::function<bool()>& done);
+  void for_each(size_t count, const std::function<void(size_t)>& func);
+
+  template<typename F>
+  auto async(F&& func) {
+    using Result = std::invoke_result_t<std::decay_t<F>>;
+    auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(func));
+    auto future = task->get_future();
+    post([task]() { (*task)(); });
+    return future;
+  }
+
+  // deferred futures are not waited for, they are evaluated on get()
+  template<typename Future>
+  void wait(const Future& future) {
+    wait_until([&]() {
+      return (future.wait_for(std::chrono::seconds(0)) != std::future_status::timeout);
+    });
+  }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void thread_func(size_t index);
+  bool pop_task(Queue& queue, Task& task);
+  void notify_waiting();
+
+  // first queue receives tasks posted from outside the pool
+  std::vector<std::unique_ptr<Queue>> m_queues;
+  std::vector<std::thread> m_threads;
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::atomic<size_t> m_pending{ };
+  std::atomic<int> m_waiting{ };
+  bool m_shutdown{ };
+};
+
+void set_thread_pool_size(int thread_count);
+ThreadPool& thread_pool();
+
+} // namespace
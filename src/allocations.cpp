@@ -0,0 +1,40 @@
+
+#include "stats.h"
+#include <cstdlib>
+#include <new>
+
+// replaces the global allocation functions, to count the allocations
+// per stage while statistics are enabled. it is only linked into the
+// executable, when built with ENABLE_ALLOCATION_STATS
+
+void* operator new(std::size_t size) {
+  spright::count_allocation();
+  for (;;) {
+    if (auto pointer = std::malloc(size ? size : 1))
+      return pointer;
+    if (auto handler = std::get_new_handler())
+      handler();
+    else
+      throw std::bad_alloc();
+  }
+}
+
+void* operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+  operator delete(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+  operator delete(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+  operator delete(pointer);
+}
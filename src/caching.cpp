@@ -0,0 +1,654 @@
+
+#include "caching.h"
+#include "stats.h"
+#include "nlohmann/json.hpp"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <random>
+
+namespace spright {
+
+namespace {
+  // increment when the cached data or the way it is computed changes
+  const auto cache_version = 1;
+
+  class KeyHasher {
+  public:
+    template<typename T, typename = std::enable_if_t<
+      std::is_arithmetic_v<T> || std::is_enum_v<T>>>
+    void add(const T& value) {
+      m_hash = hash_bytes(&value, sizeof(T), m_hash);
+    }
+    void add(std::string_view string) {
+      add(string.size());
+      m_hash = hash_bytes(string.data(), string.size(), m_hash);
+    }
+    void add(const Rect& rect) { add(rect.x); add(rect.y); add(rect.w); add(rect.h); }
+    void add(const Size& size) { add(size.x); add(size.y); }
+    void add(const PointF& point) { add(point.x); add(point.y); }
+    void add(const RGBA& color) { add(color.rgba); }
+    uint64_t hash() const { return m_hash; }
+
+  private:
+    uint64_t m_hash{ };
+  };
+
+  nlohmann::json json_rect(const Rect& rect) {
+    return { rect.x, rect.y, rect.w, rect.h };
+  }
+
+  Rect to_rect(const nlohmann::json& json) {
+    return { json.at(0).get<int>(), json.at(1).get<int>(),
+             json.at(2).get<int>(), json.at(3).get<int>() };
+  }
+
+  nlohmann::json json_point(const PointF& point) {
+    return { point.x, point.y };
+  }
+
+  PointF to_point(const nlohmann::json& json) {
+    return { json.at(0).get<float>(), json.at(1).get<float>() };
+  }
+
+  uint64_t get_file_hash(const std::filesystem::path& filename) {
+    auto file = std::ifstream(filename, std::ios::in | std::ios::binary);
+    if (!file.good())
+      throw std::runtime_error("reading file '" + path_to_utf8(filename) + "' failed");
+
+    auto hash = uint64_t{ };
+    auto buffer = std::vector<char>(1 << 16);
+    while (file) {
+      file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+      hash = hash_bytes(buffer.data(), static_cast<size_t>(file.gcount()), hash);
+    }
+    return hash;
+  }
+
+  struct PixelCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t variant;
+    int32_t width;
+    int32_t height;
+    uint64_t file_size;
+    int64_t file_time;
+    uint64_t file_hash;
+  };
+  const auto pixel_cache_magic = std::string_view("SPRIGHT", 8);
+
+  std::filesystem::path get_pixel_cache_filename(const std::filesystem::path& cache_path,
+      const std::filesystem::path& source, RGBA variant) {
+    const auto key = path_to_utf8(std::filesystem::weakly_canonical(source));
+    auto ss = std::stringstream();
+    ss << std::hex << std::setw(16) << std::setfill('0') <<
+      hash_bytes(key.data(), key.size(), variant.rgba) << ".rgba";
+    return cache_path / "pixels" / ss.str();
+  }
+
+  int64_t get_file_time(const std::filesystem::path& filename) {
+    return static_cast<int64_t>(std::filesystem::last_write_time(filename)
+      .time_since_epoch().count());
+  }
+
+  bool read_header(const std::filesystem::path& filename, PixelCacheHeader& header) {
+    auto file = std::ifstream(filename, std::ios::in | std::ios::binary);
+    return file.read(reinterpret_cast<char*>(&header), sizeof(header)).good();
+  }
+
+  // the hash stored with the decoded pixels is valid,
+  // as long as the file's size and time did not change
+  bool read_cached_file_hash(const std::filesystem::path& cache_path,
+      const std::filesystem::path& source, RGBA variant, uint64_t& file_hash) {
+    auto cached = PixelCacheHeader{ };
+    auto error = std::error_code{ };
+    if (!read_header(get_pixel_cache_filename(cache_path, source, variant), cached) ||
+        !std::equal(pixel_cache_magic.begin(), pixel_cache_magic.end(), cached.magic) ||
+        cached.version != cache_version ||
+        cached.variant != variant.rgba ||
+        cached.file_size != std::filesystem::file_size(source, error) || error ||
+        cached.file_time != get_file_time(source) ||
+        !cached.file_hash)
+      return false;
+    file_hash = cached.file_hash;
+    return true;
+  }
+
+  void write_header(std::ostream& file, const PixelCacheHeader& header) {
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  }
+
+  // entry files are named by the hex key, followed by ".json" or "-N.png"
+  bool get_entry_file_key(const std::filesystem::path& filename, uint64_t& key) {
+    const auto name = path_to_utf8(filename.filename());
+    const auto digits = size_t{ 16 };
+    if (name.size() <= digits ||
+        name.find_first_not_of("0123456789abcdef") != digits)
+      return false;
+    const auto suffix = std::string_view(name).substr(digits);
+    const auto is_png = [&]() {
+      return (suffix.size() > 5 && suffix.front() == '-' &&
+        suffix.substr(suffix.size() - 4) == ".png" &&
+        suffix.find_first_not_of("0123456789", 1) == suffix.size() - 4);
+    };
+    if (suffix != ".json" && !is_png())
+      return false;
+    key = std::stoull(name.substr(0, digits), nullptr, 16);
+    return true;
+  }
+
+  // a manifest lists the keys of the entries used by a definition
+  std::set<uint64_t> read_manifest(const std::filesystem::path& filename) {
+    auto keys = std::set<uint64_t>();
+    auto file = std::ifstream(filename, std::ios::in);
+    for (auto key = uint64_t{ }; file >> std::hex >> key; )
+      keys.insert(key);
+    return keys;
+  }
+
+  void write_manifest(const std::filesystem::path& filename,
+      const std::set<uint64_t>& keys) {
+    auto error = std::error_code{ };
+    std::filesystem::create_directories(filename.parent_path(), error);
+    auto temp_filename = filename;
+    temp_filename += "." + std::to_string(std::random_device()()) + ".tmp";
+    {
+      auto file = std::ofstream(temp_filename, std::ios::out);
+      for (auto key : keys)
+        file << std::hex << std::setw(16) << std::setfill('0') << key << '\n';
+      if (!file.good()) {
+        file.close();
+        std::filesystem::remove(temp_filename, error);
+        return;
+      }
+    }
+    std::filesystem::rename(temp_filename, filename, error);
+    if (error)
+      std::filesystem::remove(temp_filename, error);
+  }
+
+  void copy_cached_file(const std::filesystem::path& from, const std::filesystem::path& to) {
+    auto error = std::error_code{ };
+    std::filesystem::create_directories(to.parent_path(), error);
+    if (!std::filesystem::copy_file(from, to,
+          std::filesystem::copy_options::overwrite_existing, error))
+      throw std::runtime_error("writing file '" + path_to_utf8(to) + "' failed");
+  }
+} // namespace
+
+void load_cached_image(const std::filesystem::path& cache_path,
+    Image& image, RGBA variant, const std::function<void(Image&)>& decode) {
+  const auto source = image.path() / image.filename();
+  auto header = PixelCacheHeader{ };
+  std::copy(pixel_cache_magic.begin(), pixel_cache_magic.end(), header.magic);
+  header.version = cache_version;
+  header.variant = variant.rgba;
+  header.width = image.width();
+  header.height = image.height();
+  header.file_size = std::filesystem::file_size(source);
+  header.file_time = get_file_time(source);
+
+  const auto pixels_size = static_cast<size_t>(image.width() * image.height()) * sizeof(RGBA);
+  const auto filename = get_pixel_cache_filename(cache_path, source, variant);
+
+  // file content is only hashed when its time changed
+  auto cached = PixelCacheHeader{ };
+  auto error = std::error_code{ };
+  if (read_header(filename, cached) &&
+      std::filesystem::file_size(filename, error) == sizeof(cached) + pixels_size &&
+      std::equal(cached.magic, cached.magic + sizeof(cached.magic), header.magic) &&
+      cached.version == header.version &&
+      cached.variant == header.variant &&
+      cached.width == header.width &&
+      cached.height == header.height &&
+      cached.file_size == header.file_size) {
+    if (cached.file_time == header.file_time) {
+      image.load_mapped(filename, sizeof(cached));
+      add_bytes_read(sizeof(cached) + pixels_size);
+      return;
+    }
+    header.file_hash = get_file_hash(source);
+    if (cached.file_hash == header.file_hash) {
+      auto file = std::fstream(filename, std::ios::in | std::ios::out | std::ios::binary);
+      write_header(file, header);
+      file.close();
+      image.load_mapped(filename, sizeof(cached));
+      add_bytes_read(sizeof(cached) + pixels_size);
+      return;
+    }
+  }
+
+  decode(image);
+  if (!header.file_hash)
+    header.file_hash = get_file_hash(source);
+
+  // written to a temporary file first, which replaces the entry when complete,
+  // so concurrent processes never map incomplete entries
+  std::filesystem::create_directories(filename.parent_path(), error);
+  auto temp_filename = filename;
+  temp_filename += "." + std::to_string(std::random_device()()) + ".tmp";
+  {
+    auto file = std::ofstream(temp_filename, std::ios::out | std::ios::binary);
+    write_header(file, header);
+    file.write(reinterpret_cast<const char*>(image.rgba()),
+      static_cast<std::streamsize>(pixels_size));
+    if (!file.good()) {
+      file.close();
+      std::filesystem::remove(temp_filename, error);
+      return;
+    }
+  }
+  std::filesystem::rename(temp_filename, filename, error);
+  if (error)
+    std::filesystem::remove(temp_filename, error);
+}
+
+struct BuildCache::Entry {
+  struct CachedSprite {
+    // index in sorted group, negative when sprite was dropped
+    int rank{ -1 };
+    Rect trimmed_source_rect{ };
+    Rect rect{ };
+    Rect trimmed_rect{ };
+    PointF pivot_point{ };
+    bool rotated{ };
+    int texture_index{ };
+    Point common_divisor_offset{ };
+    Size common_divisor_margin{ };
+    std::vector<PointF> vertices;
+    std::vector<int> triangles;
+  };
+  struct CachedTexture {
+    std::filesystem::path filename;
+    int width;
+    int height;
+    size_t offset;
+    size_t count;
+  };
+  std::vector<CachedSprite> sprites;
+  std::vector<CachedTexture> textures;
+};
+
+BuildCache::BuildCache(const Settings& settings)
+  : m_settings(settings) {
+
+  // definitions are identified by their input and output files
+  const auto normalize = [](const std::filesystem::path& path) {
+    auto error = std::error_code{ };
+    const auto absolute = std::filesystem::absolute(path, error);
+    if (error)
+      return path_to_utf8(path);
+    const auto canonical = std::filesystem::weakly_canonical(absolute, error);
+    return path_to_utf8(error ? absolute : canonical);
+  };
+  auto hasher = KeyHasher();
+  for (const auto& input_file : settings.input_files)
+    hasher.add(normalize(input_file));
+  hasher.add(settings.input);
+  hasher.add(normalize(settings.output_path / settings.output_file));
+  m_definition_hash = hasher.hash();
+}
+
+uint64_t BuildCache::get_source_hash(const Image& source, RGBA colorkey) {
+  const auto filename = std::filesystem::weakly_canonical(
+    source.path() / source.filename());
+  auto lock = std::unique_lock(m_mutex);
+  auto& hash = m_source_hashes[filename];
+  if (!hash.valid())
+    hash = std::async(std::launch::deferred,
+      [filename, colorkey, cache_path = m_settings.cache_path]() {
+        auto file_hash = uint64_t{ };
+        if (!cache_path.empty() &&
+            read_cached_file_hash(cache_path, filename, colorkey, file_hash))
+          return file_hash;
+        return get_file_hash(filename);
+      }).share();
+  const auto future = hash;
+  lock.unlock();
+  return future.get();
+}
+
+std::filesystem::path BuildCache::get_filename(const CacheKey& key,
+    std::string_view suffix) const {
+  auto ss = std::stringstream();
+  ss << std::hex << std::setw(16) << std::setfill('0') << key.hash << suffix;
+  return m_settings.cache_path / ss.str();
+}
+
+std::filesystem::path BuildCache::get_manifest_filename() const {
+  auto ss = std::stringstream();
+  ss << std::hex << std::setw(16) << std::setfill('0') << m_definition_hash << ".keys";
+  return m_settings.cache_path / "manifests" / ss.str();
+}
+
+CacheKey BuildCache::get_key(SpriteSpan sprites) {
+  auto hasher = KeyHasher();
+  hasher.add(cache_version);
+  hasher.add(m_settings.debug);
+
+  const auto& texture = *sprites.front().texture;
+  hasher.add(texture.filename.filename());
+  hasher.add(texture.filename.count());
+  hasher.add(texture.width);
+  hasher.add(texture.height);
+  hasher.add(texture.max_width);
+  hasher.add(texture.max_height);
+  hasher.add(texture.power_of_two);
+  hasher.add(texture.square);
+  hasher.add(texture.align_width);
+  hasher.add(texture.allow_rotate);
+  hasher.add(texture.border_padding);
+  hasher.add(texture.shape_padding);
+  hasher.add(texture.duplicates);
+  hasher.add(texture.alpha);
+  hasher.add(texture.colorkey);
+  hasher.add(texture.bleed_radius);
+  hasher.add(texture.pack);
+
+  auto key = CacheKey{ };
+  for (const auto& sprite : sprites) {
+    key.sprite_indices.push_back(sprite.index);
+    hasher.add(sprite.id);
+    hasher.add(path_to_utf8(sprite.source->path() / sprite.source->filename()));
+    hasher.add(get_source_hash(*sprite.source, sprite.source_colorkey));
+    hasher.add(sprite.source_colorkey);
+    hasher.add(sprite.source_rect);
+    hasher.add(sprite.pivot.x);
+    hasher.add(sprite.pivot.y);
+    hasher.add(sprite.pivot_point);
+    hasher.add(sprite.trim);
+    hasher.add(sprite.trim_margin);
+    hasher.add(sprite.trim_threshold);
+    hasher.add(sprite.trim_gray_levels);
+    hasher.add(sprite.trim_max_vertices);
+    hasher.add(sprite.crop);
+    hasher.add(sprite.extrude);
+    hasher.add(sprite.common_divisor);
+    hasher.add(sprite.tags.size());
+    for (const auto& [tag, value] : sprite.tags) {
+      hasher.add(tag);
+      hasher.add(value);
+    }
+  }
+  key.hash = hasher.hash();
+
+  auto lock = std::lock_guard(m_mutex);
+  m_used_keys.insert(key.hash);
+  return key;
+}
+
+bool BuildCache::restore(const CacheKey& key, SpriteSpan sprites,
+    std::vector<PackedTexture>& packed_textures) {
+  auto entry = std::shared_ptr<const Entry>();
+  auto lock = std::unique_lock(m_mutex);
+  if (auto it = m_entries.find(key.hash); it != m_entries.end())
+    entry = it->second;
+  lock.unlock();
+
+  // output textures of entries in memory were written by a previous run
+  auto error = std::error_code{ };
+  if (entry)
+    for (const auto& texture : entry->textures)
+      if (!std::filesystem::exists(m_settings.output_path / texture.filename, error)) {
+        entry.reset();
+        break;
+      }
+
+  auto restored_from_file = false;
+  if (!entry) {
+    auto file_entry = std::make_shared<Entry>();
+    if (m_settings.cache_path.empty() || !read_entry(key, *file_entry))
+      return false;
+    entry = std::move(file_entry);
+    restored_from_file = true;
+  }
+
+  if (entry->sprites.size() != sprites.size())
+    return false;
+  for (const auto& sprite : entry->sprites)
+    if (sprite.rank >= static_cast<int>(sprites.size()))
+      return false;
+  for (const auto& texture : entry->textures)
+    if (texture.offset + texture.count > sprites.size())
+      return false;
+
+  if (restored_from_file) {
+    try {
+      auto index = 0;
+      for (const auto& texture : entry->textures)
+        copy_cached_file(get_filename(key, "-" + std::to_string(index++) + ".png"),
+          m_settings.output_path / texture.filename);
+    }
+    catch (const std::exception&) {
+      return false;
+    }
+    if (m_settings.watch) {
+      lock.lock();
+      m_entries[key.hash] = entry;
+      lock.unlock();
+    }
+  }
+
+  // sprites were reordered and duplicates dropped while packing
+  const auto originals = std::vector<Sprite>(sprites.begin(), sprites.end());
+  for (auto i = size_t{ }; i < sprites.size(); ++i) {
+    const auto& cached = entry->sprites[i];
+    auto& sprite = sprites[i];
+    if (cached.rank < 0) {
+      sprite = { };
+      continue;
+    }
+    sprite = originals[static_cast<size_t>(cached.rank)];
+    sprite.trimmed_source_rect = cached.trimmed_source_rect;
+    sprite.rect = cached.rect;
+    sprite.trimmed_rect = cached.trimmed_rect;
+    sprite.pivot_point = cached.pivot_point;
+    sprite.rotated = cached.rotated;
+    sprite.texture_index = cached.texture_index;
+    sprite.common_divisor_offset = cached.common_divisor_offset;
+    sprite.common_divisor_margin = cached.common_divisor_margin;
+    sprite.vertices = cached.vertices;
+    sprite.triangles = cached.triangles;
+    update_mask_spans(sprite);
+  }
+
+  const auto& texture = *originals.front().texture;
+  for (const auto& cached : entry->textures)
+    packed_textures.push_back(PackedTexture{
+      cached.filename,
+      cached.width,
+      cached.height,
+      sprites.subspan(cached.offset, cached.count),
+      texture.alpha,
+      texture.colorkey,
+      texture.bleed_radius,
+    });
+  return true;
+}
+
+void BuildCache::store(const CacheKey& key, SpriteSpan sprites,
+    const std::vector<PackedTexture>& packed_textures) {
+  auto entry = std::make_shared<Entry>();
+  for (const auto& sprite : sprites) {
+    auto& cached = entry->sprites.emplace_back();
+    if (!sprite.texture)
+      continue;
+
+    const auto it = std::lower_bound(key.sprite_indices.begin(),
+      key.sprite_indices.end(), sprite.index);
+    cached.rank = static_cast<int>(std::distance(key.sprite_indices.begin(), it));
+    cached.trimmed_source_rect = sprite.trimmed_source_rect;
+    cached.rect = sprite.rect;
+    cached.trimmed_rect = sprite.trimmed_rect;
+    cached.pivot_point = sprite.pivot_point;
+    cached.rotated = sprite.rotated;
+    cached.texture_index = sprite.texture_index;
+    cached.common_divisor_offset = sprite.common_divisor_offset;
+    cached.common_divisor_margin = sprite.common_divisor_margin;
+    cached.vertices = sprite.vertices;
+    cached.triangles = sprite.triangles;
+  }
+  for (const auto& texture : packed_textures)
+    entry->textures.push_back({
+      texture.filename,
+      texture.width,
+      texture.height,
+      static_cast<size_t>(std::distance(sprites.data(), texture.sprites.data())),
+      texture.sprites.size(),
+    });
+
+  // the output is complete without the entry, so failing to write it
+  // does not fail the build
+  if (!m_settings.cache_path.empty())
+    try {
+      write_entry(key, *entry);
+    }
+    catch (const std::exception& ex) {
+      std::cerr << "warning: " << ex.what() << std::endl;
+    }
+
+  if (m_settings.watch) {
+    auto lock = std::lock_guard(m_mutex);
+    m_entries[key.hash] = std::move(entry);
+  }
+}
+
+void BuildCache::invalidate(const std::filesystem::path& filename) {
+  auto lock = std::lock_guard(m_mutex);
+  m_source_hashes.erase(filename);
+}
+
+void BuildCache::remove_unused() {
+  auto lock = std::lock_guard(m_mutex);
+  for (auto it = m_entries.begin(); it != m_entries.end(); )
+    it = (m_used_keys.count(it->first) ? std::next(it) : m_entries.erase(it));
+
+  if (!m_settings.cache_path.empty()) {
+    // only entries the definition used before can be removed,
+    // unless another definition sharing the directory also uses them
+    const auto manifest = get_manifest_filename();
+    auto unused = read_manifest(manifest);
+    for (auto key : m_used_keys)
+      unused.erase(key);
+
+    auto error = std::error_code{ };
+    if (!unused.empty())
+      for (const auto& file : std::filesystem::directory_iterator(
+            manifest.parent_path(), error))
+        if (file.path() != manifest && file.path().extension() == ".keys")
+          for (auto key : read_manifest(file.path()))
+            unused.erase(key);
+
+    if (!unused.empty())
+      for (const auto& file : std::filesystem::directory_iterator(
+            m_settings.cache_path, error)) {
+        auto key = uint64_t{ };
+        if (file.is_regular_file(error) &&
+            get_entry_file_key(file.path(), key) &&
+            unused.count(key))
+          std::filesystem::remove(file.path(), error);
+      }
+    write_manifest(manifest, m_used_keys);
+  }
+  m_used_keys.clear();
+}
+
+bool BuildCache::read_entry(const CacheKey& key, Entry& entry) try {
+  auto file = std::ifstream(get_filename(key, ".json"), std::ios::in | std::ios::binary);
+  if (!file.good())
+    return false;
+  const auto json = nlohmann::json::parse(file);
+
+  for (const auto& json_sprite : json.at("sprites")) {
+    auto& cached = entry.sprites.emplace_back();
+    if (json_sprite.is_null())
+      continue;
+    cached.rank = json_sprite.at("rank").get<int>();
+    cached.trimmed_source_rect = to_rect(json_sprite.at("trimmedSourceRect"));
+    cached.rect = to_rect(json_sprite.at("rect"));
+    cached.trimmed_rect = to_rect(json_sprite.at("trimmedRect"));
+    cached.pivot_point = to_point(json_sprite.at("pivot"));
+    cached.rotated = json_sprite.at("rotated").get<bool>();
+    cached.texture_index = json_sprite.at("textureIndex").get<int>();
+    const auto offset = to_rect(json_sprite.at("commonDivisor"));
+    cached.common_divisor_offset = { offset.x, offset.y };
+    cached.common_divisor_margin = { offset.w, offset.h };
+    for (const auto& vertex : json_sprite.at("vertices"))
+      cached.vertices.push_back(to_point(vertex));
+    if (json_sprite.contains("triangles"))
+      cached.triangles = json_sprite.at("triangles").get<std::vector<int>>();
+  }
+
+  auto index = 0;
+  for (const auto& json_texture : json.at("textures")) {
+    entry.textures.push_back({
+      utf8_to_path(json_texture.at("filename").get<std::string>()),
+      json_texture.at("width").get<int>(),
+      json_texture.at("height").get<int>(),
+      json_texture.at("offset").get<size_t>(),
+      json_texture.at("count").get<size_t>(),
+    });
+    if (!std::filesystem::exists(get_filename(key, "-" + std::to_string(index++) + ".png")))
+      return false;
+  }
+  return true;
+}
+catch (const std::exception&) {
+  return false;
+}
+
+void BuildCache::write_entry(const CacheKey& key, const Entry& entry) {
+  auto json = nlohmann::json::object();
+  auto& json_sprites = json["sprites"];
+  json_sprites = nlohmann::json::array();
+  for (const auto& cached : entry.sprites) {
+    auto& json_sprite = json_sprites.emplace_back();
+    if (cached.rank < 0)
+      continue;
+    json_sprite["rank"] = cached.rank;
+    json_sprite["trimmedSourceRect"] = json_rect(cached.trimmed_source_rect);
+    json_sprite["rect"] = json_rect(cached.rect);
+    json_sprite["trimmedRect"] = json_rect(cached.trimmed_rect);
+    json_sprite["pivot"] = json_point(cached.pivot_point);
+    json_sprite["rotated"] = cached.rotated;
+    json_sprite["textureIndex"] = cached.texture_index;
+    json_sprite["commonDivisor"] = json_rect({
+      cached.common_divisor_offset.x, cached.common_divisor_offset.y,
+      cached.common_divisor_margin.x, cached.common_divisor_margin.y });
+    auto& json_vertices = json_sprite["vertices"];
+    json_vertices = nlohmann::json::array();
+    for (const auto& vertex : cached.vertices)
+      json_vertices.push_back(json_point(vertex));
+    if (!cached.triangles.empty())
+      json_sprite["triangles"] = cached.triangles;
+  }
+
+  auto& json_textures = json["textures"];
+  json_textures = nlohmann::json::array();
+  auto index = 0;
+  for (const auto& cached : entry.textures) {
+    auto& json_texture = json_textures.emplace_back();
+    json_texture["filename"] = path_to_utf8(cached.filename);
+    json_texture["width"] = cached.width;
+    json_texture["height"] = cached.height;
+    json_texture["offset"] = cached.offset;
+    json_texture["count"] = cached.count;
+    copy_cached_file(m_settings.output_path / cached.filename,
+      get_filename(key, "-" + std::to_string(index++) + ".png"));
+  }
+
+  // written last, so entries are only found when they are complete
+  const auto filename = get_filename(key, ".json");
+  auto error = std::error_code{ };
+  std::filesystem::create_directories(filename.parent_path(), error);
+  auto file = std::ofstream(filename, std::ios::out | std::ios::binary);
+  file << json.dump();
+  if (!file.good()) {
+    file.close();
+    std::filesystem::remove(filename, error);
+    throw std::runtime_error("writing file '" + path_to_utf8(filename) + "' failed");
+  }
+}
+
+} // namespace
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "packing.h"
+#include <functional>
+#include <mutex>
+#include <set>
+
+namespace spright {
+
+struct CacheKey {
+  uint64_t hash;
+  std::vector<int> sprite_indices;
+};
+
+// stores the packing and output textures of each output texture's sprites,
+// so they can be reused when neither the sources nor the definition changed.
+// in watch mode the results are also kept in memory between runs
+class BuildCache {
+public:
+  explicit BuildCache(const Settings& settings);
+
+  CacheKey get_key(SpriteSpan sprites);
+  bool restore(const CacheKey& key, SpriteSpan sprites,
+    std::vector<PackedTexture>& packed_textures);
+  void store(const CacheKey& key, SpriteSpan sprites,
+    const std::vector<PackedTexture>& packed_textures);
+  void invalidate(const std::filesystem::path& filename);
+  // removes the entries of the definition, whose keys were not requested
+  // since the last call. entries also used by other definitions sharing the
+  // cache directory are kept
+  void remove_unused();
+
+private:
+  struct Entry;
+  uint64_t get_source_hash(const Image& source, RGBA colorkey);
+  std::filesystem::path get_filename(const CacheKey& key,
+    std::string_view suffix) const;
+  std::filesystem::path get_manifest_filename() const;
+  bool read_entry(const CacheKey& key, Entry& entry);
+  void write_entry(const CacheKey& key, const Entry& entry);
+
+  const Settings& m_settings;
+  std::mutex m_mutex;
+  std::map<std::filesystem::path, std::shared_future<uint64_t>> m_source_hashes;
+  std::map<uint64_t, std::shared_ptr<const Entry>> m_entries;
+  std::set<uint64_t> m_used_keys;
+  uint64_t m_definition_hash{ };
+};
+
+// maps the image's pixels from the cache, when its file did not change.
+// otherwise decode is called and its result stored in the cache
+void load_cached_image(const std::filesystem::path& cache_path,
+  Image& image, RGBA variant, const std::function<void(Image&)>& decode);
+
+} // namespace
@@ -1,5 +1,6 @@
 
 #include "common.h"
+#include "ThreadPool.h"
 #include <cstring>
 #include <charconv>
 #include <algorithm>
@@ -161,4 +162,38 @@ std::pair<std::string_view, int> split_name_number(LStringView str) {
   return { str, 0 };
 }
 
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed) {
+  // processes 8 bytes at a time, finalized like MurmurHash3's fmix64
+  const auto mix = [](uint64_t h, uint64_t v) {
+    v *= 0x87c37b91114253d5ull;
+    v = (v << 31) | (v >> 33);
+    v *= 0x4cf5ad432745937full;
+    h ^= v;
+    h = (h << 27) | (h >> 37);
+    return h * 5 + 0x52dce729;
+  };
+  auto h = seed ^ (size * 0x9e3779b97f4a7c15ull);
+  auto bytes = static_cast<const uint8_t*>(data);
+  for (; size >= 8; size -= 8, bytes += 8) {
+    auto value = uint64_t{ };
+    std::memcpy(&value, bytes, 8);
+    h = mix(h, value);
+  }
+  if (size) {
+    auto value = uint64_t{ };
+    std::memcpy(&value, bytes, size);
+    h = mix(h, value);
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+void for_each_parallel(size_t count, const std::function<void(size_t)>& func) {
+  thread_pool().for_each(count, func);
+}
+
 } // namespace
@@ -4,8 +4,9 @@
 #include <vector>
 #include <filesystem>
 #include <cctype>
+#include <cstdint>
 #include <cmath>
-#include <future>
+#include <functional>
 #include <algorithm>
 #include <utility>
 
@@ -120,16 +121,16 @@ static_assert(floor_to_pot(6) == 4);
 static_assert(floor_to_pot(7) == 4);
 static_assert(floor_to_pot(8) == 8);
 
+// fast non-cryptographic hash, pass the previous result as seed to combine
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0);
+
+// executes func for each index on the shared thread pool, lower indices first
+void for_each_parallel(size_t count, const std::function<void(size_t)>& func);
+
 template<typename It, typename F>
 void for_each_parallel(It begin, It end, F&& func) {
-  if (begin == end)
-    return;
-  auto results = std::vector<std::future<void>>();
-  std::transform(std::next(begin), end, std::back_inserter(results),
-    [&func](auto& e) { return std::async(std::launch::async, func, e); });
-  func(*begin);
-  for (const auto& result : results)
-    result.wait();
+  for_each_parallel(static_cast<size_t>(std::distance(begin, end)),
+    [&](size_t index) { func(*std::next(begin, static_cast<std::ptrdiff_t>(index))); });
 }
 
 } // namespace
@@ -1,13 +1,31 @@
 
 #include "image.h"
+#include "scanning.h"
 #include "stb/stb_image.h"
 #include "stb/stb_image_write.h"
-#include "texpack/bleeding.h"
 #include <algorithm>
 #include <stdexcept>
+#include <cstdlib>
 #include <cstring>
+#include <memory>
+#include <optional>
 #include <utility>
 
+#if defined(__SSE2__) || defined(_M_X64)
+# define IMAGE_SSE2
+# include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+# include <intrin.h>
+#endif
+
+#if !defined(_WIN32)
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+
 namespace spright {
 
 namespace {
@@ -20,26 +38,189 @@ namespace {
     check(containing(image.bounds(), rect));
   }
 
+  void check_rect(const ImageView& image, const Rect& rect) {
+    check(containing(image.bounds(), rect));
+  }
+
   template <typename P>
-  bool all_of(const Image& image, const Rect& rect, P&& predicate) {
+  bool all_of(const ImageView& image, const Rect& rect, P&& predicate) {
     check_rect(image, rect);
-    const auto rgba = image.rgba();
-    for (auto y = rect.y; y < rect.y + rect.h; ++y)
+    for (auto y = rect.y; y < rect.y + rect.h; ++y) {
+      const auto row = image.row(y);
       for (auto x = rect.x; x < rect.x + rect.w; ++x)
-        if (!predicate(rgba[y * image.width() + x]))
+        if (!predicate(row[x]))
           return false;
+    }
     return true;
   }
 
+  // rows narrower than this are tested inline, since the call costs more
+  const auto min_kernel_width = 16;
+
+  template <typename P>
+  bool none_found(const ImageView& image, const Rect& rect,
+      FindPixel find, int threshold, P&& predicate) {
+    if (rect.w < min_kernel_width)
+      return all_of(image, rect, [&](const RGBA& rgba) { return !predicate(rgba); });
+
+    check_rect(image, rect);
+    for (auto y = rect.y; y < rect.y + rect.h; ++y)
+      if (find(image.row(y) + rect.x, rect.w, threshold) != rect.w)
+        return false;
+    return true;
+  }
+
+  // returns the first bit at or after begin, which differs from the bits
+  // of invert, or end when there is none
+  int find_bit(const MonoMask::Word* words, int begin, int end, MonoMask::Word invert) {
+    if (begin >= end)
+      return end;
+    const auto bits = MonoMask::word_bits;
+    const auto last = (end - 1) / bits;
+    auto index = begin / bits;
+    auto word = (words[index] ^ invert) & (~MonoMask::Word{ } << (begin % bits));
+    while (!word) {
+      if (++index > last)
+        return end;
+      word = (words[index] ^ invert);
+    }
+    return std::min(index * bits + MonoMask::lowest_bit(word), end);
+  }
+
   template <typename F>
-  void for_each_pixel(const Image& image, Rect rect, F&& func) {
+  void for_each_pixel(const ImageView& image, Rect rect, F&& func) {
     for (auto y = 0; y < rect.h; ++y) {
-      auto row = image.rgba() + image.width() * (rect.y + y) + rect.x;
+      auto row = image.row(rect.y + y) + rect.x;
       for (auto x = 0; x < rect.w; ++x, ++row)
         func(*row);
     }
   }
 
+#if defined(IMAGE_SSE2)
+  template <bool Mirror>
+  void transpose_block_4x4(const RGBA* source, int source_stride,
+      RGBA* dest, int dest_stride) {
+    const auto load = [&](int y) {
+      return _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + y * source_stride));
+    };
+    const auto r0 = load(0), r1 = load(1), r2 = load(2), r3 = load(3);
+    const auto t0 = _mm_unpacklo_epi32(r0, r1);
+    const auto t1 = _mm_unpacklo_epi32(r2, r3);
+    const auto t2 = _mm_unpackhi_epi32(r0, r1);
+    const auto t3 = _mm_unpackhi_epi32(r2, r3);
+    const auto store = [&](int x, __m128i column) {
+      if (Mirror)
+        column = _mm_shuffle_epi32(column, _MM_SHUFFLE(0, 1, 2, 3));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + x * dest_stride), column);
+    };
+    store(0, _mm_unpacklo_epi64(t0, t1));
+    store(1, _mm_unpackhi_epi64(t0, t1));
+    store(2, _mm_unpacklo_epi64(t2, t3));
+    store(3, _mm_unpackhi_epi64(t2, t3));
+  }
+#endif
+
+  // copies the source pixel (x, y) to the dest pixel (y, x), or (h-1 - y, x)
+  // when mirrored. it is done in tiles which fit in the cache, so neither
+  // the reads nor the writes stride through the whole images
+  template <bool Mirror>
+  void transpose(const RGBA* source, int source_stride,
+      RGBA* dest, int dest_stride, int w, int h) {
+    const auto tile_size = 16;
+    const auto dest_at = [&](int x, int y) -> RGBA& {
+      return dest[x * dest_stride + (Mirror ? h - 1 - y : y)];
+    };
+    for (auto ty = 0; ty < h; ty += tile_size)
+      for (auto tx = 0; tx < w; tx += tile_size) {
+        const auto y1 = std::min(ty + tile_size, h);
+        const auto x1 = std::min(tx + tile_size, w);
+        auto y = ty;
+        for (; y + 4 <= y1; y += 4) {
+          auto x = tx;
+#if defined(IMAGE_SSE2)
+          for (; x + 4 <= x1; x += 4)
+            transpose_block_4x4<Mirror>(source + y * source_stride + x, source_stride,
+              &dest_at(x, Mirror ? y + 3 : y), dest_stride);
+#endif
+          for (; x < x1; ++x)
+            for (auto i = 0; i < 4; ++i)
+              dest_at(x, y + i) = source[(y + i) * source_stride + x];
+        }
+        for (; y < y1; ++y)
+          for (auto x = tx; x < x1; ++x)
+            dest_at(x, y) = source[y * source_stride + x];
+      }
+  }
+
+  void filter_clear_alpha(RGBA* pixels, int count) {
+    auto i = 0;
+#if defined(IMAGE_SSE2)
+    const auto alpha_mask = _mm_set1_epi32(static_cast<int>(0xFF000000));
+    for (; i + 4 <= count; i += 4) {
+      const auto p = reinterpret_cast<__m128i*>(pixels + i);
+      const auto rgba = _mm_loadu_si128(p);
+      const auto transparent = _mm_cmpeq_epi32(_mm_and_si128(rgba, alpha_mask), _mm_setzero_si128());
+      _mm_storeu_si128(p, _mm_andnot_si128(transparent, rgba));
+    }
+#endif
+    for (; i < count; ++i)
+      if (pixels[i].a == 0)
+        pixels[i] = RGBA{ };
+  }
+
+  void filter_make_opaque(RGBA* pixels, int count, RGBA background) {
+    auto i = 0;
+#if defined(IMAGE_SSE2)
+    const auto alpha_mask = _mm_set1_epi32(static_cast<int>(0xFF000000));
+    const auto color = _mm_set1_epi32(static_cast<int>(background.rgba));
+    for (; i + 4 <= count; i += 4) {
+      const auto p = reinterpret_cast<__m128i*>(pixels + i);
+      const auto rgba = _mm_loadu_si128(p);
+      const auto transparent = _mm_cmpeq_epi32(_mm_and_si128(rgba, alpha_mask), _mm_setzero_si128());
+      _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(transparent, color),
+        _mm_andnot_si128(transparent, _mm_or_si128(rgba, alpha_mask))));
+    }
+#endif
+    for (; i < count; ++i) {
+      if (pixels[i].a == 0)
+        pixels[i] = background;
+      else
+        pixels[i].a = 255;
+    }
+  }
+
+  void filter_premultiply_alpha(RGBA* pixels, int count) {
+    auto i = 0;
+#if defined(IMAGE_SSE2)
+    // multiply the color channels by alpha and the alpha channel by 256
+    const auto zero = _mm_setzero_si128();
+    const auto color_mask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+    const auto alpha_factor = _mm_set_epi16(256, 0, 0, 0, 256, 0, 0, 0);
+    const auto multiply_4 = [&](__m128i channels) {
+      auto alpha = _mm_shufflelo_epi16(channels, _MM_SHUFFLE(3, 3, 3, 3));
+      alpha = _mm_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+      const auto factor = _mm_or_si128(_mm_and_si128(alpha, color_mask), alpha_factor);
+      return _mm_srli_epi16(_mm_mullo_epi16(channels, factor), 8);
+    };
+    for (; i + 4 <= count; i += 4) {
+      const auto p = reinterpret_cast<__m128i*>(pixels + i);
+      const auto rgba = _mm_loadu_si128(p);
+      _mm_storeu_si128(p, _mm_packus_epi16(
+        multiply_4(_mm_unpacklo_epi8(rgba, zero)),
+        multiply_4(_mm_unpackhi_epi8(rgba, zero))));
+    }
+#endif
+    const auto multiply = [](int channel, int alpha) {
+      return static_cast<uint8_t>(channel * alpha / 256);
+    };
+    for (; i < count; ++i) {
+      auto& rgba = pixels[i];
+      rgba.r = multiply(rgba.r, rgba.a);
+      rgba.g = multiply(rgba.g, rgba.a);
+      rgba.b = multiply(rgba.b, rgba.a);
+    }
+  }
+
   void blend(Image& image, int x, int y, const RGBA& color) {
     auto& a = image.rgba_at({ x, y });
     const auto& b = color;
@@ -49,86 +230,264 @@ namespace {
     a.a = std::max(a.a, b.a);
   };
 
-  template <int sides, // 4 or 8
-    typename Color,
-    typename GetPixel, // Color&(int x, int y)
-    typename Match, // bool Match(Color color)
-    typename Count> // void Count(int x, int y)
-  void flood_fill(
-      int start_x, int start_y,
-      int w, int h,
-      const Color& new_color,
-      GetPixel&& get_pixel,
-      Match&& match,
-      Count&& count = [](int, int) {}) {
-
-    // cancel when new color is indistinguishable from rest
-    if (match(new_color))
-      return;
-
-    auto stack = std::vector<Point>();
-    const auto add = [&](auto x, auto y) {
-      auto& pixel = get_pixel(x, y);
-      if (match(pixel)) {
-        pixel = new_color;
-        stack.push_back(Point{ x, y });
-      }
+  // two-pass connected component labeling of the runs of used pixels,
+  // returns the bounds of the 8-connected components ordered by their
+  // first pixel. the rows are split into bands, which are labeled in
+  // parallel and then merged at their borders
+  std::vector<Rect> find_connected_components(const ImageView& image,
+      bool gray_levels, const Rect& rect) {
+    check_rect(image, rect);
+    const auto& kernels = scan_kernels();
+    const auto find_used = (gray_levels ?
+      kernels.find_gray_at_least : kernels.find_alpha_at_least);
+    const auto find_unused = (gray_levels ?
+      kernels.find_gray_below : kernels.find_alpha_below);
+
+    // union-find, where the root is the lowest index of a set
+    const auto find_root = [](std::vector<uint32_t>& parents, uint32_t index) {
+      while (parents[index] != index)
+        index = parents[index] = parents[parents[index]];
+      return index;
     };
-    add(start_x, start_y);
-
-    while (!stack.empty()) {
-      const auto [x, y] = stack.back();
-      stack.pop_back();
-      count(x, y);
-
-      if (y > 0) add(x, y - 1);
-      if (y < h - 1) add(x, y + 1);
-      if (sides == 4) {
-        if (x > 0) add(x - 1, y);
-        if (x < w - 1) add(x + 1, y);
+    const auto unite = [&](std::vector<uint32_t>& parents, uint32_t a, uint32_t b) {
+      a = find_root(parents, a);
+      b = find_root(parents, b);
+      if (a != b)
+        parents[std::max(a, b)] = std::min(a, b);
+    };
+    // runs in consecutive rows touch, when they overlap or meet diagonally
+    const auto unite_rows = [&](const std::vector<RowSpan>& runs,
+        std::vector<uint32_t>& parents, size_t prev_begin, size_t prev_end,
+        size_t begin, size_t end) {
+      auto j = prev_begin;
+      for (auto i = begin; i < end; ++i) {
+        while (j < prev_end && runs[j].x1 < runs[i].x0)
+          ++j;
+        for (auto k = j; k < prev_end && runs[k].x0 <= runs[i].x1; ++k)
+          unite(parents, static_cast<uint32_t>(i), static_cast<uint32_t>(k));
       }
-      else {
-        if (x > 0) {
-          add(x - 1, y);
-          if (y > 0) add(x - 1, y - 1);
-          if (y < h - 1) add(x - 1, y + 1);
-        }
-        if (x < w - 1) {
-          add(x + 1, y);
-          if (y > 0) add(x + 1, y - 1);
-          if (y < h - 1) add(x + 1, y + 1);
+    };
+
+    struct Band {
+      std::vector<RowSpan> runs;
+      std::vector<uint32_t> parents;
+      size_t first_row_end;
+      size_t last_row_begin;
+    };
+    const auto band_height = 64;
+    auto bands = std::vector<Band>(static_cast<size_t>(
+      (rect.h + band_height - 1) / band_height));
+    for_each_parallel(bands.size(), [&](size_t index) {
+      auto& band = bands[index];
+      const auto y0 = static_cast<int>(index) * band_height;
+      const auto y1 = std::min(y0 + band_height, rect.h);
+      auto row_begin = size_t{ };
+      for (auto y = y0; y < y1; ++y) {
+        const auto row = image.row(rect.y + y) + rect.x;
+        const auto prev_begin = row_begin;
+        row_begin = band.runs.size();
+        for (auto x = 0; ; ) {
+          x += find_used(row + x, rect.w - x, 1);
+          if (x == rect.w)
+            break;
+          const auto x1 = x + find_unused(row + x, rect.w - x, 1);
+          band.parents.push_back(static_cast<uint32_t>(band.runs.size()));
+          band.runs.push_back({ y, x, x1 });
+          x = x1;
+          if (x == rect.w)
+            break;
         }
+        if (y == y0)
+          band.first_row_end = band.runs.size();
+        else
+          unite_rows(band.runs, band.parents, prev_begin, row_begin,
+            row_begin, band.runs.size());
+      }
+      band.last_row_begin = row_begin;
+    });
+
+    // concatenate the bands and unite the runs at their borders
+    auto runs = std::vector<RowSpan>();
+    auto parents = std::vector<uint32_t>();
+    auto last_row_begin = size_t{ };
+    for (auto& band : bands) {
+      const auto offset = runs.size();
+      runs.insert(runs.end(), band.runs.begin(), band.runs.end());
+      for (auto parent : band.parents)
+        parents.push_back(static_cast<uint32_t>(parent + offset));
+      if (offset)
+        unite_rows(runs, parents, last_row_begin, offset,
+          offset, offset + band.first_row_end);
+      last_row_begin = offset + band.last_row_begin;
+      band = { };
+    }
+
+    // second pass, roots are visited before the other runs of their set
+    struct Bounds { int x0, y0, x1, y1; };
+    auto components = std::vector<Bounds>();
+    auto component_index = std::vector<uint32_t>(runs.size());
+    for (auto i = size_t{ }; i < runs.size(); ++i) {
+      const auto& run = runs[i];
+      const auto root = find_root(parents, static_cast<uint32_t>(i));
+      if (root == i) {
+        component_index[i] = static_cast<uint32_t>(components.size());
+        components.push_back({ run.x0, run.y, run.x1, run.y + 1 });
+        continue;
       }
+      component_index[i] = component_index[root];
+      auto& bounds = components[component_index[i]];
+      bounds.x0 = std::min(bounds.x0, run.x0);
+      bounds.x1 = std::max(bounds.x1, run.x1);
+      bounds.y1 = run.y + 1;
     }
+
+    auto rects = std::vector<Rect>();
+    rects.reserve(components.size());
+    for (const auto& bounds : components)
+      rects.push_back({ rect.x + bounds.x0, rect.y + bounds.y0,
+                        bounds.x1 - bounds.x0, bounds.y1 - bounds.y0 });
+    return rects;
   }
 
-  void merge_adjacent_rects(const Image& image, std::vector<Rect>& rects,
-      int distance, bool gray_levels) {
+  // buckets rects by the grid cells they overlap, so only the rects
+  // near a rect need to be considered
+  class RectGrid {
+  public:
+    RectGrid(const std::vector<Rect>& rects, int cell_size)
+      : m_cell_size(cell_size) {
+      auto bounds = rects.front();
+      for (const auto& rect : rects)
+        bounds = combine(bounds, rect);
+      m_origin = { bounds.x, bounds.y };
+      m_columns = bounds.w / cell_size + 1;
+      m_rows = bounds.h / cell_size + 1;
+      m_cells.resize(static_cast<size_t>(m_columns * m_rows));
+      m_visited.resize(rects.size());
+    }
+
+    void insert(uint32_t id, const Rect& rect) {
+      for_each_cell(rect, [&](std::vector<uint32_t>& cell) {
+        if (cell.empty() || cell.back() != id)
+          cell.push_back(id);
+      });
+    }
+
+    // calls func once for each id inserted in a cell overlapping rect
+    template <typename F>
+    void query(const Rect& rect, F&& func) {
+      ++m_stamp;
+      for_each_cell(rect, [&](std::vector<uint32_t>& cell) {
+        for (auto id : cell)
+          if (std::exchange(m_visited[id], m_stamp) != m_stamp)
+            func(id);
+      });
+    }
+
+  private:
+    template <typename F>
+    void for_each_cell(const Rect& rect, F&& func) {
+      const auto cell = [&](int value, int origin, int count) {
+        return std::clamp((value - origin) / m_cell_size, 0, count - 1);
+      };
+      const auto x0 = cell(rect.x, m_origin.x, m_columns);
+      const auto y0 = cell(rect.y, m_origin.y, m_rows);
+      const auto x1 = cell(rect.x + rect.w - 1, m_origin.x, m_columns);
+      const auto y1 = cell(rect.y + rect.h - 1, m_origin.y, m_rows);
+      for (auto y = y0; y <= y1; ++y)
+        for (auto x = x0; x <= x1; ++x)
+          func(m_cells[static_cast<size_t>(y * m_columns + x)]);
+    }
+
+    int m_cell_size;
+    Point m_origin{ };
+    int m_columns{ };
+    int m_rows{ };
+    std::vector<std::vector<uint32_t>> m_cells;
+    std::vector<uint32_t> m_visited;
+    uint32_t m_stamp{ };
+  };
+
+  void merge_adjacent_rects(const ImageView& image, std::vector<Rect>& rects,
+      int distance, bool gray_levels, const OccupancyIndex* sheet_index) {
+    if (rects.size() < 2)
+      return;
+
+    // with many rects, the pixels of the intersections are not rescanned.
+    // the intersections are within the rects, so only their bounds need
+    // to be indexed, when no index of the image can be used
+    auto bounds = rects.front();
+    for (const auto& rect : rects)
+      bounds = combine(bounds, rect);
+    auto local_index = std::optional<OccupancyIndex>();
+    if (sheet_index && (sheet_index->gray_levels() != gray_levels ||
+        sheet_index->threshold() != 1 ||
+        !containing(sheet_index->bounds(), bounds)))
+      sheet_index = nullptr;
+    if (!sheet_index && rects.size() >= 64)
+      local_index.emplace(image, gray_levels, 1, bounds);
+    const auto index = (sheet_index ? sheet_index :
+      local_index ? &*local_index : nullptr);
 
     const auto adjacent = [&](const Rect& a, const Rect& b) {
       const auto intersection = intersect(a, expand(b, distance));
       if (empty(intersection))
         return false;
+      if (index)
+        return !index->is_unused(intersection);
       if (gray_levels)
         return !is_fully_black(image, 1, intersection);
       return !is_fully_transparent(image, 1, intersection);
     };
 
+    auto size_sum = int64_t{ };
+    for (const auto& rect : rects)
+      size_sum += std::max(rect.w, rect.h);
+    const auto cell_size = std::max(static_cast<int>(size_sum /
+      static_cast<int64_t>(rects.size())) + distance * 2, 8);
+
+    // rects are identified by their initial index, which stays stable
+    // while they are moved around by removing merged rects
+    auto grid = RectGrid(rects, cell_size);
+    auto ids = std::vector<uint32_t>(rects.size());
+    auto positions = std::vector<size_t>(rects.size());
+    for (auto i = size_t{ }; i < rects.size(); ++i) {
+      ids[i] = static_cast<uint32_t>(i);
+      positions[i] = i;
+      grid.insert(ids[i], rects[i]);
+    }
+    const auto remove = [&](size_t position) {
+      positions[ids.back()] = position;
+      ids[position] = ids.back();
+      rects[position] = rects.back();
+      ids.pop_back();
+      rects.pop_back();
+    };
+
+    // merges in the same order as repeated pairwise sweeps would,
+    // but only tests the rects which are near
+    auto candidates = std::vector<size_t>();
     for (;;) {
       auto merged = false;
       for (auto i = size_t{ }; i < rects.size(); ++i) {
-        auto& a = rects[i];
         for (auto j = i + 1; j < rects.size(); ) {
-          auto& b = rects[j];
-          if (adjacent(a, b)) {
-            a = combine(a, b);
-            b = rects.back();
-            rects.pop_back();
-            merged = true;
-          }
-          else {
-            ++j;
-          }
+          candidates.clear();
+          grid.query(expand(rects[i], distance), [&](uint32_t id) {
+            const auto position = positions[id];
+            if (position >= j && position < rects.size() && ids[position] == id)
+              candidates.push_back(position);
+          });
+          std::sort(candidates.begin(), candidates.end());
+
+          const auto it = std::find_if(candidates.begin(), candidates.end(),
+            [&](size_t position) { return adjacent(rects[i], rects[position]); });
+          if (it == candidates.end())
+            break;
+
+          j = *it;
+          rects[i] = combine(rects[i], rects[j]);
+          grid.insert(ids[i], rects[i]);
+          remove(j);
+          merged = true;
         }
       }
       if (!merged)
@@ -165,18 +524,6 @@ namespace {
       }
     }
   }
-
-  // http://paulbourke.net/geometry/polygonmesh/
-  bool point_in_polygon(float x, float y, const std::vector<PointF>& p) {
-    auto c = false;
-    for (auto i = size_t{ }, j = p.size() - 1; i < p.size(); j = i++) {
-      if ((((p[i].y <= y) && (y < p[j].y)) ||
-           ((p[j].y <= y) && (y < p[i].y))) &&
-          (x < (p[j].x - p[i].x) * (y - p[i].y) / (p[j].y - p[i].y) + p[i].x))
-        c = !c;
-    }
-    return c;
-  }
 } // namespace
 
 Image::Image(int width, int height)
@@ -195,39 +542,121 @@ Image::Image(int width, int height, const RGBA& background)
   std::fill(m_data, m_data + (m_width * m_height), background);
 }
 
-Image::Image(std::filesystem::path path, std::filesystem::path filename)
+Image::Image(std::filesystem::path path, std::filesystem::path filename,
+    bool defer_loading)
   : m_path(std::move(path)),
     m_filename(std::move(filename)) {
 
+  if (!defer_loading) {
+    load();
+    return;
+  }
+
+  // only read size from header, pixels are decoded by load()
+  auto channels = 0;
 #if defined(EMBED_TEST_FILES)
   if (m_path / m_filename == "test/Items.png") {
-    unsigned char file[] {
+    const unsigned char file[] {
 #include "test/Items.png.inc"
     };
-    auto channels = 0;
-    m_data = reinterpret_cast<RGBA*>(stbi_load_from_memory(
-        file, sizeof(file), &m_width, &m_height, &channels, sizeof(RGBA)));
+    stbi_info_from_memory(file, sizeof(file), &m_width, &m_height, &channels);
     return;
   }
 #endif
 
   const auto full_path = path_to_utf8(m_path / m_filename);
+  auto valid = false;
   if (auto file = std::fopen(full_path.c_str(), "rb")) {
-    auto channels = 0;
-    m_data = reinterpret_cast<RGBA*>(stbi_load_from_file(
-        file, &m_width, &m_height, &channels, sizeof(RGBA)));
+    valid = (stbi_info_from_file(file, &m_width, &m_height, &channels) != 0);
     std::fclose(file);
   }
-  if (!m_data)
+  if (!valid)
     throw std::runtime_error("loading file '" + full_path + "' failed");
 }
 
+void Image::load() {
+  if (m_data)
+    return;
+
+  const auto full_path = path_to_utf8(m_path / m_filename);
+  auto data = std::add_pointer_t<RGBA>{ };
+  auto width = 0;
+  auto height = 0;
+  auto channels = 0;
+#if defined(EMBED_TEST_FILES)
+  if (m_path / m_filename == "test/Items.png") {
+    unsigned char file[] {
+#include "test/Items.png.inc"
+    };
+    data = reinterpret_cast<RGBA*>(stbi_load_from_memory(
+        file, sizeof(file), &width, &height, &channels, sizeof(RGBA)));
+  }
+  else
+#endif
+  if (auto file = std::fopen(full_path.c_str(), "rb")) {
+    data = reinterpret_cast<RGBA*>(stbi_load_from_file(
+        file, &width, &height, &channels, sizeof(RGBA)));
+    std::fclose(file);
+  }
+
+  // size is already known when loading was deferred
+  if (data && m_width && (width != m_width || height != m_height)) {
+    stbi_image_free(data);
+    data = nullptr;
+  }
+  if (!data)
+    throw std::runtime_error("loading file '" + full_path + "' failed");
+
+  if (!m_width) {
+    m_width = width;
+    m_height = height;
+  }
+  m_data = data;
+}
+
+// maps raw RGBA pixels of the known size, starting at offset in file.
+// pages are copied on write, so the file is never modified
+void Image::load_mapped(const std::filesystem::path& filename, size_t offset) {
+  if (m_data)
+    return;
+
+  const auto full_path = path_to_utf8(filename);
+  const auto size = offset + static_cast<size_t>(m_width * m_height) * sizeof(RGBA);
+#if !defined(_WIN32)
+  const auto fd = ::open(full_path.c_str(), O_RDONLY);
+  auto mapping = MAP_FAILED;
+  if (fd >= 0) {
+    mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+  }
+  if (mapping == MAP_FAILED)
+    throw std::runtime_error("loading file '" + full_path + "' failed");
+
+  m_mapping_size = size;
+  m_data = reinterpret_cast<RGBA*>(static_cast<char*>(mapping) + offset);
+#else
+  auto data = static_cast<char*>(std::malloc(size));
+  auto valid = false;
+  if (auto file = std::fopen(full_path.c_str(), "rb")) {
+    valid = (data && std::fread(data, 1, size, file) == size);
+    std::fclose(file);
+  }
+  if (!valid) {
+    std::free(data);
+    throw std::runtime_error("loading file '" + full_path + "' failed");
+  }
+  std::memmove(data, data + offset, size - offset);
+  m_data = reinterpret_cast<RGBA*>(data);
+#endif
+}
+
 Image::Image(Image&& rhs)
   : m_path(std::exchange(rhs.m_path, { })),
     m_filename(std::exchange(rhs.m_filename, { })),
     m_data(std::exchange(rhs.m_data, nullptr)),
     m_width(std::exchange(rhs.m_width, 0)),
-    m_height(std::exchange(rhs.m_height, 0)) {
+    m_height(std::exchange(rhs.m_height, 0)),
+    m_mapping_size(std::exchange(rhs.m_mapping_size, 0)) {
 }
 
 Image& Image::operator=(Image&& rhs) {
@@ -237,10 +666,19 @@ Image& Image::operator=(Image&& rhs) {
   std::swap(m_data, tmp.m_data);
   std::swap(m_width, tmp.m_width);
   std::swap(m_height, tmp.m_height);
+  std::swap(m_mapping_size, tmp.m_mapping_size);
   return *this;
 }
 
 Image::~Image() {
+#if !defined(_WIN32)
+  if (m_mapping_size) {
+    const auto offset = m_mapping_size -
+      static_cast<size_t>(m_width * m_height) * sizeof(RGBA);
+    ::munmap(reinterpret_cast<char*>(m_data) - offset, m_mapping_size);
+    return;
+  }
+#endif
   stbi_image_free(m_data);
 }
 
@@ -278,6 +716,182 @@ MonoImage::~MonoImage() {
   stbi_image_free(m_data);
 }
 
+ImageView::ImageView(const Image& image, const Rect& rect)
+  : ImageView(ImageView(image).subview(rect)) {
+}
+
+ImageView ImageView::subview(const Rect& rect) const {
+  check_rect(*this, rect);
+  return ImageView(row(rect.y) + rect.x, rect.w, rect.h, m_stride);
+}
+
+int MonoMask::lowest_bit(Word word) {
+#if defined(_MSC_VER)
+  auto index = 0ul;
+  _BitScanForward64(&index, word);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctzll(word);
+#endif
+}
+
+MonoMask::MonoMask(int width, int height)
+  : m_width(width),
+    m_height(height),
+    m_words_per_row((width + word_bits - 1) / word_bits),
+    m_words(static_cast<size_t>(m_words_per_row) * static_cast<size_t>(height)) {
+}
+
+void MonoMask::set_run(int y, int x0, int x1) {
+  x0 = std::max(x0, 0);
+  x1 = std::min(x1, m_width);
+  if (x0 >= x1)
+    return;
+  const auto words = row(y);
+  const auto first = x0 / word_bits;
+  const auto last = (x1 - 1) / word_bits;
+  const auto first_mask = ~Word{ } << (x0 % word_bits);
+  const auto last_mask = ~Word{ } >> (word_bits - 1 - (x1 - 1) % word_bits);
+  if (first == last) {
+    words[first] |= (first_mask & last_mask);
+    return;
+  }
+  words[first] |= first_mask;
+  for (auto i = first + 1; i < last; ++i)
+    words[i] = ~Word{ };
+  words[last] |= last_mask;
+}
+
+int MonoMask::find_set(int y, int x) const {
+  return find_bit(row(y), x, m_width, Word{ });
+}
+
+int MonoMask::find_unset(int y, int x) const {
+  return find_bit(row(y), x, m_width, ~Word{ });
+}
+
+OccupancyIndex::OccupancyIndex(const ImageView& image, bool gray_levels,
+    int threshold, const Rect& rect)
+  : m_origin(empty(rect) ? Point{ } : Point{ rect.x, rect.y }),
+    m_mask(get_used_mask(empty(rect) ? image : image.subview(rect),
+      gray_levels, threshold)),
+    m_tile_columns((m_mask.width() + tile_size - 1) / tile_size),
+    m_tile_rows((m_mask.height() + tile_size - 1) / tile_size),
+    m_tile_sums((static_cast<size_t>(m_tile_columns) + 1) *
+                (static_cast<size_t>(m_tile_rows) + 1)),
+    m_gray_levels(gray_levels),
+    m_threshold(threshold) {
+
+  // each tile row's running count is added to the sums of the row above
+  const auto stride = static_cast<size_t>(m_tile_columns) + 1;
+  for (auto ty = 0; ty < m_tile_rows; ++ty) {
+    const auto y0 = ty * tile_size;
+    const auto y1 = std::min(y0 + tile_size, m_mask.height());
+    const auto above = m_tile_sums.data() + static_cast<size_t>(ty) * stride + 1;
+    const auto sums = above + stride;
+    auto used = uint32_t{ };
+    for (auto tx = 0; tx < m_tile_columns; ++tx) {
+      const auto x0 = tx * tile_size;
+      const auto x1 = std::min(x0 + tile_size, m_mask.width());
+      for (auto y = y0; y < y1; ++y)
+        if (find_bit(m_mask.row(y), x0, x1, MonoMask::Word{ }) < x1) {
+          ++used;
+          break;
+        }
+      sums[tx] = above[tx] + used;
+    }
+  }
+}
+
+uint32_t OccupancyIndex::count_used_tiles(int x0, int y0, int x1, int y1) const {
+  const auto stride = static_cast<size_t>(m_tile_columns) + 1;
+  const auto sum = [&](int x, int y) {
+    return m_tile_sums[static_cast<size_t>(y) * stride + static_cast<size_t>(x)];
+  };
+  return sum(x1, y1) - sum(x0, y1) - sum(x1, y0) + sum(x0, y0);
+}
+
+bool OccupancyIndex::is_used_in_mask(const Rect& rect) const {
+  if (empty(rect))
+    return false;
+
+  // only the rows of the tile rows with used tiles are tested
+  const auto tx0 = rect.x / tile_size;
+  const auto tx1 = (rect.x1() + tile_size - 1) / tile_size;
+  for (auto ty = rect.y / tile_size; ty * tile_size < rect.y1(); ++ty) {
+    if (!count_used_tiles(tx0, ty, tx1, ty + 1))
+      continue;
+    const auto y0 = std::max(ty * tile_size, rect.y);
+    const auto y1 = std::min((ty + 1) * tile_size, rect.y1());
+    for (auto y = y0; y < y1; ++y)
+      if (find_bit(m_mask.row(y), rect.x, rect.x1(), MonoMask::Word{ }) < rect.x1())
+        return true;
+  }
+  return false;
+}
+
+bool OccupancyIndex::is_used(const Rect& rect) const {
+  // the tiles completely within the rect are answered by the table,
+  // the mask is only tested at the edges
+  const auto cx0 = (rect.x + tile_size - 1) / tile_size;
+  const auto cy0 = (rect.y + tile_size - 1) / tile_size;
+  const auto cx1 = rect.x1() / tile_size;
+  const auto cy1 = rect.y1() / tile_size;
+  if (cx0 >= cx1 || cy0 >= cy1)
+    return is_used_in_mask(rect);
+
+  if (count_used_tiles(cx0, cy0, cx1, cy1))
+    return true;
+
+  const auto x0 = cx0 * tile_size;
+  const auto y0 = cy0 * tile_size;
+  const auto x1 = cx1 * tile_size;
+  const auto y1 = cy1 * tile_size;
+  return is_used_in_mask({ rect.x, rect.y, rect.w, y0 - rect.y }) ||
+         is_used_in_mask({ rect.x, y1, rect.w, rect.y1() - y1 }) ||
+         is_used_in_mask({ rect.x, y0, x0 - rect.x, y1 - y0 }) ||
+         is_used_in_mask({ x1, y0, rect.x1() - x1, y1 - y0 });
+}
+
+bool OccupancyIndex::is_unused(const Rect& rect) const {
+  check(containing(bounds(), rect));
+  return !is_used({ rect.x - m_origin.x, rect.y - m_origin.y, rect.w, rect.h });
+}
+
+Rect OccupancyIndex::get_used_bounds(const Rect& rect) const {
+  if (empty(rect))
+    return get_used_bounds(bounds());
+
+  // an unused rect shrinks to its last pixel
+  if (is_unused(rect))
+    return { rect.x + rect.w - 1, rect.y + rect.h - 1, 1, 1 };
+
+  // finds the first of count lines, which contains a used pixel
+  // in the union with all previous lines
+  const auto find_first = [](int count, auto&& any_used_within) {
+    auto first = 0;
+    auto last = count - 1;
+    while (first < last) {
+      const auto middle = first + (last - first) / 2;
+      if (any_used_within(middle + 1))
+        last = middle;
+      else
+        first = middle + 1;
+    }
+    return first;
+  };
+  const auto top = rect.y + find_first(rect.h, [&](int n) {
+    return !is_unused({ rect.x, rect.y, rect.w, n }); });
+  const auto bottom = rect.y1() - 1 - find_first(rect.h, [&](int n) {
+    return !is_unused({ rect.x, rect.y1() - n, rect.w, n }); });
+  const auto h = bottom - top + 1;
+  const auto left = rect.x + find_first(rect.w, [&](int n) {
+    return !is_unused({ rect.x, top, n, h }); });
+  const auto right = rect.x1() - 1 - find_first(rect.w, [&](int n) {
+    return !is_unused({ rect.x1() - n, top, n, h }); });
+  return { left, top, right - left + 1, h };
+}
+
 Image Image::clone(const Rect& rect) const {
   if (empty(rect))
     return clone(bounds());
@@ -295,60 +909,110 @@ void save_image(const Image& image, const std::filesystem::path& filename) {
     throw std::runtime_error("writing file '" + path_to_utf8(filename) + "' failed");
 }
 
-void copy_rect(const Image& source, const Rect& source_rect, Image& dest, int dx, int dy) {
+void copy_rect(const ImageView& source, const Rect& source_rect, Image& dest, int dx, int dy,
+    AlphaFilter filter, RGBA background) {
   const auto [sx, sy, w, h] = source_rect;
   const auto dest_rect = Rect{ dx, dy, w, h };
   if (source_rect == source.bounds() &&
       dest_rect == dest.bounds() &&
-      source_rect == dest_rect) {
-    std::memcpy(dest.rgba(), source.rgba(),
+      source_rect == dest_rect &&
+      source.stride() == w) {
+    std::memcpy(dest.rgba(), source.row(0),
       static_cast<size_t>(w * h) * sizeof(RGBA));
+    filter_alpha(dest.rgba(), w * h, filter, background);
   }
   else {
     check_rect(source, source_rect);
     check_rect(dest, dest_rect);
-    for (auto y = 0; y < h; ++y)
-      std::memcpy(
-        dest.rgba() + ((dy + y) * dest.width() + dx),
-        source.rgba() + ((sy + y) * source.width() + sx),
+    for (auto y = 0; y < h; ++y) {
+      const auto row = dest.rgba() + ((dy + y) * dest.width() + dx);
+      std::memcpy(row,
+        source.row(sy + y) + sx,
         static_cast<size_t>(w) * sizeof(RGBA));
+      filter_alpha(row, w, filter, background);
+    }
   }
 }
 
-void copy_rect_rotated_cw(const Image& source, const Rect& source_rect, Image& dest, int dx, int dy) {
+void copy_rect_rotated_cw(const ImageView& source, const Rect& source_rect, Image& dest, int dx, int dy,
+    AlphaFilter filter, RGBA background) {
   const auto [sx, sy, w, h] = source_rect;
   check_rect(source, source_rect);
   check_rect(dest, { dx, dy, h, w });
-  for (auto y = 0; y < h; ++y)
-    for (auto x = 0; x < w; ++x)
-      std::memcpy(
-        dest.rgba() + ((dy + x) * dest.width() + (dx + h-1 - y)),
-        source.rgba() + ((sy + y) * source.width() + sx + x),
-        sizeof(RGBA));
+  transpose<true>(source.row(sy) + sx, source.stride(),
+    dest.rgba() + (dy * dest.width() + dx), dest.width(), w, h);
+  if (filter != AlphaFilter::none)
+    for (auto y = 0; y < w; ++y)
+      filter_alpha(dest.rgba() + ((dy + y) * dest.width() + dx), h, filter, background);
 }
 
-void copy_rect(const Image& source, const Rect& source_rect, Image& dest, int dx, int dy,
-    const std::vector<PointF>& mask_vertices) {
+void copy_rect(const ImageView& source, const Rect& source_rect, Image& dest, int dx, int dy,
+    const std::vector<RowSpan>& mask_spans, AlphaFilter filter, RGBA background) {
   const auto [sx, sy, w, h] = source_rect;
-  for (auto y = 0; y < h; ++y)
-    for (auto x = 0; x < w; ++x)
-      if (point_in_polygon(static_cast<float>(x) + 0.5f, static_cast<float>(y) + 0.5f, mask_vertices)) {
-        check(containing(source.bounds(), Point{ sx + x, sy + y }));
-        check(containing(dest.bounds(), Point{ dx + x, dy + y }));
-        dest.rgba_at({ dx + x, dy + y }) = source.rgba_at({ sx + x, sy + y });
-      }
+  check_rect(source, source_rect);
+  check_rect(dest, { dx, dy, w, h });
+  for (const auto& span : mask_spans) {
+    check(span.y >= 0 && span.y < h && span.x0 >= 0 && span.x1 <= w);
+    const auto row = dest.rgba() + ((dy + span.y) * dest.width() + dx + span.x0);
+    std::memcpy(row,
+      source.row(sy + span.y) + sx + span.x0,
+      static_cast<size_t>(span.x1 - span.x0) * sizeof(RGBA));
+    filter_alpha(row, span.x1 - span.x0, filter, background);
+  }
 }
 
-void copy_rect_rotated_cw(const Image& source, const Rect& source_rect, Image& dest, int dx, int dy,
-    const std::vector<PointF>& mask_vertices) {
+void copy_rect_rotated_cw(const ImageView& source, const Rect& source_rect, Image& dest, int dx, int dy,
+    const std::vector<RowSpan>& mask_spans, AlphaFilter filter, RGBA background) {
   const auto [sx, sy, w, h] = source_rect;
-  for (auto y = 0; y < w; ++y)
-    for (auto x = 0; x < h; ++x)
-      if (point_in_polygon(static_cast<float>(x) + 0.5f, static_cast<float>(y) + 0.5f, mask_vertices)) {
-        check(containing(source.bounds(), Point{ sx + y, sy + x }));
-        check(containing(dest.bounds(), Point{ dx + x, dy + y }));
-        dest.rgba_at({ dx + x, dy + y }) = source.rgba_at({ sx + y, sy + x });
-      }
+  check_rect(source, source_rect);
+  check_rect(dest, { dx, dy, h, w });
+  auto rotated = std::vector<RGBA>(static_cast<size_t>(w * h));
+  transpose<false>(source.row(sy) + sx, source.stride(),
+    rotated.data(), h, w, h);
+
+  for (const auto& span : mask_spans) {
+    check(span.y >= 0 && span.y < w && span.x0 >= 0 && span.x1 <= h);
+    const auto row = dest.rgba() + ((dy + span.y) * dest.width() + dx + span.x0);
+    std::memcpy(row,
+      rotated.data() + (span.y * h + span.x0),
+      static_cast<size_t>(span.x1 - span.x0) * sizeof(RGBA));
+    filter_alpha(row, span.x1 - span.x0, filter, background);
+  }
+}
+
+std::vector<RowSpan> get_polygon_spans(const std::vector<PointF>& vertices,
+    int width, int height) {
+  // the pixels whose centers are inside, found by intersecting each row's
+  // center line with the edges (http://paulbourke.net/geometry/polygonmesh/)
+  auto spans = std::vector<RowSpan>();
+  auto crossings = std::vector<float>();
+  const auto& p = vertices;
+  for (auto row = 0; row < height; ++row) {
+    const auto y = static_cast<float>(row) + 0.5f;
+    crossings.clear();
+    for (auto i = size_t{ }, j = p.size() - 1; i < p.size(); j = i++)
+      if (((p[i].y <= y) && (y < p[j].y)) ||
+          ((p[j].y <= y) && (y < p[i].y)))
+        crossings.push_back((p[j].x - p[i].x) * (y - p[i].y) / (p[j].y - p[i].y) + p[i].x);
+    std::sort(crossings.begin(), crossings.end());
+
+    // a pixel is inside, when an odd number of crossings is right of its center
+    const auto first_pixel_right_of = [&](float x) {
+      return std::clamp(static_cast<int>(std::ceil(static_cast<double>(x) - 0.5)), 0, width);
+    };
+    auto inside = (crossings.size() % 2 == 1);
+    auto x0 = 0;
+    for (auto crossing : crossings) {
+      const auto x1 = first_pixel_right_of(crossing);
+      if (inside && x0 < x1)
+        spans.push_back({ row, x0, x1 });
+      inside = !inside;
+      x0 = std::max(x0, x1);
+    }
+    if (inside && x0 < width)
+      spans.push_back({ row, x0, width });
+  }
+  return spans;
 }
 
 void extrude_rect(Image& image, const Rect& rect, bool left, bool top, bool right, bool bottom) {
@@ -405,28 +1069,31 @@ void fill_rect(Image& image, const Rect& rect, const RGBA& color) {
       blend(image, x, y, color);
 }
 
-bool is_opaque(const Image& image, const Rect& rect) {
+bool is_opaque(const ImageView& image, const Rect& rect) {
   if (empty(rect))
     return is_opaque(image, image.bounds());
 
-  return all_of(image, rect, [](const RGBA& rgba) { return (rgba.a == 255); });
+  return none_found(image, rect, scan_kernels().find_alpha_below, 255,
+    [](const RGBA& rgba) { return (rgba.a < 255); });
 }
 
-bool is_fully_transparent(const Image& image, int threshold, const Rect& rect) {
+bool is_fully_transparent(const ImageView& image, int threshold, const Rect& rect) {
   if (empty(rect))
     return is_fully_transparent(image, threshold, image.bounds());
 
-  return all_of(image, rect, [&](const RGBA& rgba) { return (rgba.a < threshold); });
+  return none_found(image, rect, scan_kernels().find_alpha_at_least, threshold,
+    [&](const RGBA& rgba) { return (rgba.a >= threshold); });
 }
 
-bool is_fully_black(const Image& image, int threshold, const Rect& rect) {
+bool is_fully_black(const ImageView& image, int threshold, const Rect& rect) {
   if (empty(rect))
     return is_fully_black(image, threshold, image.bounds());
 
-  return all_of(image, rect, [&](const RGBA& rgba) { return (rgba.gray() < threshold); });
+  return none_found(image, rect, scan_kernels().find_gray_at_least, threshold,
+    [&](const RGBA& rgba) { return (rgba.gray() >= threshold); });
 }
 
-bool is_identical(const Image& image_a, const Rect& rect_a, const Image& image_b, const Rect& rect_b) {
+bool is_identical(const ImageView& image_a, const Rect& rect_a, const ImageView& image_b, const Rect& rect_b) {
   check_rect(image_a, rect_a);
   check_rect(image_b, rect_b);
   if (rect_a.w != rect_b.w || rect_a.h != rect_b.h)
@@ -434,44 +1101,62 @@ bool is_identical(const Image& image_a, const Rect& rect_a, const Image& image_b
 
   for (auto y = 0; y < rect_a.h; ++y)
     if (std::memcmp(
-        image_a.rgba() + (rect_a.y + y) * image_a.width() + rect_a.x,
-        image_b.rgba() + (rect_b.y + y) * image_b.width() + rect_b.x,
+        image_a.row(rect_a.y + y) + rect_a.x,
+        image_b.row(rect_b.y + y) + rect_b.x,
         static_cast<size_t>(rect_a.w) * sizeof(RGBA)))
       return false;
 
   return true;
 }
 
-Rect get_used_bounds(const Image& image, bool gray_levels, int threshold, const Rect& rect) {
+uint64_t get_pixel_hash(const ImageView& image, const Rect& rect) {
+  check_rect(image, rect);
+  const auto size = std::pair{ rect.w, rect.h };
+  auto hash = hash_bytes(&size, sizeof(size));
+  for (auto y = rect.y; y < rect.y + rect.h; ++y)
+    hash = hash_bytes(image.row(y) + rect.x,
+      static_cast<size_t>(rect.w) * sizeof(RGBA), hash);
+  return hash;
+}
+
+Rect get_used_bounds(const ImageView& image, bool gray_levels, int threshold, const Rect& rect) {
   if (empty(rect))
     return get_used_bounds(image, gray_levels, threshold, image.bounds());
 
-  const auto x1 = rect.x + rect.w - 1;
-  const auto y1 = rect.y + rect.h - 1;
-
-  const auto check = (gray_levels ? is_fully_black : is_fully_transparent);
-
-  auto min_y = rect.y;
-  for (; min_y < y1; ++min_y)
-    if (!check(image, threshold, { rect.x, min_y, rect.w, 1 }))
-      break;
-
-  auto max_y = y1;
-  for (; max_y > min_y; --max_y)
-    if (!check(image, threshold, { rect.x, max_y, rect.w, 1 }))
-      break;
-
-  auto min_x = rect.x;
-  for (; min_x < x1; ++min_x)
-    if (!check(image, threshold, { min_x, min_y, 1, max_y - min_y + 1 }))
-      break;
+  check_rect(image, rect);
+  const auto& kernels = scan_kernels();
+  const auto find_used = (gray_levels ?
+    kernels.find_gray_at_least : kernels.find_alpha_at_least);
+  const auto find_last_used = (gray_levels ?
+    kernels.find_last_gray_at_least : kernels.find_last_alpha_at_least);
+
+  // stream the rows once, after a row's first used pixel only the part
+  // right of the last used column found so far needs to be searched,
+  // which is done backwards from the row's end
+  auto min_x = rect.w;
+  auto max_x = -1;
+  auto min_y = -1;
+  auto max_y = -1;
+  for (auto y = 0; y < rect.h; ++y) {
+    const auto row = image.row(rect.y + y) + rect.x;
+    const auto first = find_used(row, rect.w, threshold);
+    if (first == rect.w)
+      continue;
+
+    if (min_y < 0)
+      min_y = y;
+    max_y = y;
+    min_x = std::min(min_x, first);
+    const auto x = std::max(max_x, first) + 1;
+    const auto last = find_last_used(row + x, rect.w - x, threshold);
+    max_x = (last >= 0 ? x + last : x - 1);
+  }
 
-  auto max_x = x1;
-  for (; max_x > min_x; --max_x)
-    if (!check(image, threshold, { max_x, min_y, 1, max_y - min_y + 1 }))
-      break;
+  // an unused rect shrinks to its last pixel
+  if (min_y < 0)
+    return { rect.x + rect.w - 1, rect.y + rect.h - 1, 1, 1 };
 
-  return { min_x, min_y, max_x - min_x + 1, max_y - min_y + 1 };
+  return { rect.x + min_x, rect.y + min_y, max_x - min_x + 1, max_y - min_y + 1 };
 }
 
 RGBA guess_colorkey(const Image& image) {
@@ -496,39 +1181,14 @@ void replace_color(Image& image, RGBA original, RGBA color) {
       original, color);
 }
 
-std::vector<Rect> find_islands(const Image& image, int merge_distance,
-    bool gray_levels, const Rect& rect) {
+std::vector<Rect> find_islands(const ImageView& image, int merge_distance,
+    bool gray_levels, const Rect& rect, const OccupancyIndex* index) {
   if (empty(rect))
     return find_islands(image, merge_distance, gray_levels,
-      get_used_bounds(image, gray_levels));
-
-  using Value = MonoImage::Value;
-  auto levels = (gray_levels ?
-    get_gray_levels(image, rect) :
-    get_alpha_levels(image, rect));
-
-  auto islands = std::vector<Rect>();
-  for (auto y = 0; y < rect.h; ++y)
-    for (auto x = 0; x < rect.w; ++x)
-      if (levels.value_at({ x, y })) {
-        auto min_x = x;
-        auto min_y = y;
-        auto max_x = x;
-        auto max_y = y;
-        flood_fill<8>(x, y, rect.w, rect.h,
-          Value{ },
-          [&](int x, int y) -> Value& { return levels.value_at({ x, y }); },
-          [&](const Value& pixel) { return (pixel != 0); },
-          [&](int x, int y) {
-            min_x = std::min(x, min_x);
-            min_y = std::min(y, min_y);
-            max_x = std::max(x, max_x);
-            max_y = std::max(y, max_y);
-          });
-        islands.push_back({ rect.x + min_x, rect.y + min_y, max_x - min_x + 1, max_y - min_y + 1 });
-      }
+      get_used_bounds(image, gray_levels), index);
 
-  merge_adjacent_rects(image, islands, merge_distance, gray_levels);
+  auto islands = find_connected_components(image, gray_levels, rect);
+  merge_adjacent_rects(image, islands, merge_distance, gray_levels, index);
 
   // fuzzy sort from top to bottom, left to right
   const auto center_considerably_less = [](const Rect& a, const Rect& b) {
@@ -544,43 +1204,137 @@ std::vector<Rect> find_islands(const Image& image, int merge_distance,
   return islands;
 }
 
+void filter_alpha(RGBA* pixels, int count, AlphaFilter filter, RGBA background) {
+  switch (filter) {
+    case AlphaFilter::none: break;
+    case AlphaFilter::clear: return filter_clear_alpha(pixels, count);
+    case AlphaFilter::premultiply: return filter_premultiply_alpha(pixels, count);
+    case AlphaFilter::opaque: return filter_make_opaque(pixels, count, background);
+  }
+}
+
 void clear_alpha(Image& image) {
-  std::for_each(image.rgba(), image.rgba() + image.width() * image.height(),
-    [](RGBA& rgba) {
-      if (rgba.a == 0)
-        rgba = RGBA{ };
-    });
+  filter_clear_alpha(image.rgba(), image.width() * image.height());
 }
 
 void make_opaque(Image& image, RGBA background) {
-  std::for_each(image.rgba(), image.rgba() + image.width() * image.height(),
-    [&](RGBA& rgba) {
-      if (rgba.a == 0)
-        rgba = background;
-      else
-        rgba.a = 255;
-    });
+  filter_make_opaque(image.rgba(), image.width() * image.height(), background);
 }
 
 void premultiply_alpha(Image& image) {
-  const auto multiply = [](int channel, int alpha) {
-    return static_cast<uint8_t>(channel * alpha / 256);
-  };
-  const auto size = image.width() * image.height();
-  auto rgba = image.rgba();
-  for (auto i = 0; i < size; ++i, ++rgba) {
-    rgba->r = multiply(rgba->r, rgba->a);
-    rgba->g = multiply(rgba->g, rgba->a);
-    rgba->b = multiply(rgba->b, rgba->a);
-  }
+  filter_premultiply_alpha(image.rgba(), image.width() * image.height());
 }
 
-void bleed_alpha(Image& image) {
-  bleed_apply(reinterpret_cast<uint8_t*>(image.rgba()),
-    image.width(), image.height());
+void bleed_alpha(Image& image, int radius, const std::vector<Rect>& regions) {
+  // transparent pixels are filled ring by ring, growing outward from the
+  // opaque pixels. each gets the average color of its neighbors, which are
+  // opaque or were filled in a previous ring. the pixels of a ring do not
+  // depend on each other, so they are filled in parallel.
+  enum : uint8_t { unvisited, queued, filled };
+  const auto width = image.width();
+  const auto height = image.height();
+  const auto size = static_cast<size_t>(width) * static_cast<size_t>(height);
+  if (!size)
+    return;
+
+  // calloc provides untouched zero pages, so sparse textures stay cheap
+  const auto state = std::unique_ptr<uint8_t, decltype(&std::free)>(
+    static_cast<uint8_t*>(std::calloc(size, 1)), &std::free);
+  if (!state)
+    throw std::bad_alloc();
+  const auto pixels = image.rgba();
+  const auto is_set = [&](size_t index) {
+    return (pixels[index].a != 0 || state.get()[index] == filled);
+  };
+  const auto for_each_neighbor = [&](size_t index, auto&& func) {
+    const auto x = static_cast<int>(index % static_cast<size_t>(width));
+    const auto y = static_cast<int>(index / static_cast<size_t>(width));
+    for (auto ny = std::max(y - 1, 0); ny <= std::min(y + 1, height - 1); ++ny)
+      for (auto nx = std::max(x - 1, 0); nx <= std::min(x + 1, width - 1); ++nx)
+        if (nx != x || ny != y)
+          func(static_cast<size_t>(ny) * static_cast<size_t>(width) + static_cast<size_t>(nx));
+  };
+
+  // the first ring are the transparent pixels next to opaque ones
+  auto ring = std::vector<size_t>();
+  const auto add_seeds = [&](const Rect& region) {
+    const auto rect = intersect(expand(region, 1), image.bounds());
+    for (auto y = rect.y; y < rect.y + rect.h; ++y)
+      for (auto x = rect.x; x < rect.x + rect.w; ++x) {
+        const auto index = static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x);
+        if (pixels[index].a != 0 || state.get()[index] != unvisited)
+          continue;
+        auto adjacent = false;
+        for_each_neighbor(index, [&](size_t neighbor) {
+          adjacent |= (pixels[neighbor].a != 0);
+        });
+        if (adjacent) {
+          state.get()[index] = queued;
+          ring.push_back(index);
+        }
+      }
+  };
+  if (regions.empty())
+    add_seeds(image.bounds());
+  for (const auto& region : regions)
+    add_seeds(region);
+
+  const auto chunk_size = size_t{ 4096 };
+  auto candidates = std::vector<std::vector<size_t>>();
+  for (auto distance = 1; !ring.empty() && (!radius || distance <= radius); ++distance) {
+    const auto chunks = (ring.size() + chunk_size - 1) / chunk_size;
+    const auto for_each_chunk = [&](auto&& func) {
+      const auto process = [&](size_t chunk) {
+        const auto begin = chunk * chunk_size;
+        func(chunk, begin, std::min(begin + chunk_size, ring.size()));
+      };
+      if (chunks == 1)
+        return process(0);
+      for_each_parallel(chunks, process);
+    };
+
+    for_each_chunk([&](size_t, size_t begin, size_t end) {
+      for (auto i = begin; i < end; ++i) {
+        auto r = 0, g = 0, b = 0, count = 0;
+        for_each_neighbor(ring[i], [&](size_t neighbor) {
+          if (is_set(neighbor)) {
+            r += pixels[neighbor].r;
+            g += pixels[neighbor].g;
+            b += pixels[neighbor].b;
+            ++count;
+          }
+        });
+        auto& pixel = pixels[ring[i]];
+        pixel.r = static_cast<uint8_t>(r / count);
+        pixel.g = static_cast<uint8_t>(g / count);
+        pixel.b = static_cast<uint8_t>(b / count);
+      }
+    });
+    for (auto index : ring)
+      state.get()[index] = filled;
+
+    // collect the next ring in parallel, then remove duplicates
+    candidates.resize(chunks);
+    for_each_chunk([&](size_t chunk, size_t begin, size_t end) {
+      auto& list = candidates[chunk];
+      list.clear();
+      for (auto i = begin; i < end; ++i)
+        for_each_neighbor(ring[i], [&](size_t neighbor) {
+          if (pixels[neighbor].a == 0 && state.get()[neighbor] == unvisited)
+            list.push_back(neighbor);
+        });
+    });
+    ring.clear();
+    for (auto chunk = size_t{ }; chunk < chunks; ++chunk)
+      for (auto index : candidates[chunk])
+        if (state.get()[index] == unvisited) {
+          state.get()[index] = queued;
+          ring.push_back(index);
+        }
+  }
 }
 
-MonoImage get_alpha_levels(const Image& image, const Rect& rect) {
+MonoImage get_alpha_levels(const ImageView& image, const Rect& rect) {
   if (empty(rect))
     return get_alpha_levels(image, get_used_bounds(image, false));
   check_rect(image, rect);
@@ -591,7 +1345,7 @@ MonoImage get_alpha_levels(const Image& image, const Rect& rect) {
   return result;
 }
 
-MonoImage get_gray_levels(const Image& image, const Rect& rect) {
+MonoImage get_gray_levels(const ImageView& image, const Rect& rect) {
   if (empty(rect))
     return get_gray_levels(image, get_used_bounds(image, true));
   check_rect(image, rect);
@@ -602,4 +1356,28 @@ MonoImage get_gray_levels(const Image& image, const Rect& rect) {
   return result;
 }
 
+MonoMask get_used_mask(const ImageView& image, bool gray_levels, int threshold) {
+  const auto& kernels = scan_kernels();
+  const auto find_used = (gray_levels ?
+    kernels.find_gray_at_least : kernels.find_alpha_at_least);
+  const auto find_unused = (gray_levels ?
+    kernels.find_gray_below : kernels.find_alpha_below);
+
+  // the runs are found by the vectorized kernels and set word by word
+  const auto w = image.width();
+  auto mask = MonoMask(w, image.height());
+  for (auto y = 0; y < image.height(); ++y) {
+    const auto row = image.row(y);
+    for (auto x = 0; ; ) {
+      x += find_used(row + x, w - x, threshold);
+      if (x == w)
+        break;
+      const auto end = x + find_unused(row + x, w - x, threshold);
+      mask.set_run(y, x, end);
+      x = end;
+    }
+  }
+  return mask;
+}
+
 } // namespace
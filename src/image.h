@@ -9,11 +9,14 @@ class Image {
 public:
   Image(int width, int height);
   Image(int width, int height, const RGBA& background);
-  Image(std::filesystem::path path, std::filesystem::path filename);
+  Image(std::filesystem::path path, std::filesystem::path filename,
+    bool defer_loading = false);
   Image(Image&& rhs);
   Image& operator=(Image&& rhs);
   ~Image();
   Image clone(const Rect& rect = {}) const;
+  void load();
+  void load_mapped(const std::filesystem::path& filename, size_t offset);
 
   const std::filesystem::path& path() const { return m_path; }
   const std::filesystem::path& filename() const { return m_filename; }
@@ -31,6 +34,7 @@ private:
   RGBA* m_data{ };
   int m_width{ };
   int m_height{ };
+  size_t m_mapping_size{ };
 };
 
 class MonoImage {
@@ -57,28 +61,151 @@ private:
   int m_height{ };
 };
 
+// non-owning read access to a rect of an image, rows are stride pixels apart
+class ImageView {
+public:
+  ImageView(const Image& image)
+    : ImageView(image.rgba(), image.width(), image.height(), image.width()) { }
+  ImageView(const Image& image, const Rect& rect);
+  ImageView(const RGBA* data, int width, int height, int stride)
+    : m_data(data), m_width(width), m_height(height), m_stride(stride) { }
+  ImageView subview(const Rect& rect) const;
+
+  int width() const { return m_width; }
+  int height() const { return m_height; }
+  int stride() const { return m_stride; }
+  Rect bounds() const { return { 0, 0, m_width, m_height }; }
+  const RGBA* row(int y) const { return m_data + static_cast<ptrdiff_t>(y) * m_stride; }
+  const RGBA& rgba_at(const Point& p) const { return row(p.y)[p.x]; }
+
+private:
+  const RGBA* m_data{ };
+  int m_width{ };
+  int m_height{ };
+  int m_stride{ };
+};
+
+// one bit per pixel, pixel x of a row is bit x % 64 of the row's word x / 64.
+// the bits right of the width are never set
+class MonoMask {
+public:
+  using Word = uint64_t;
+  static constexpr int word_bits = 64;
+  // index of the lowest set bit of a word, which must not be zero
+  static int lowest_bit(Word word);
+
+  MonoMask() = default;
+  MonoMask(int width, int height);
+
+  int width() const { return m_width; }
+  int height() const { return m_height; }
+  int words_per_row() const { return m_words_per_row; }
+  Rect bounds() const { return { 0, 0, m_width, m_height }; }
+  const Word* row(int y) const { return m_words.data() + row_offset(y); }
+  Word* row(int y) { return m_words.data() + row_offset(y); }
+  // pixels outside the bounds are not set
+  bool test(int x, int y) const {
+    return (x >= 0 && y >= 0 && x < m_width && y < m_height &&
+      ((row(y)[x / word_bits] >> (x % word_bits)) & 1));
+  }
+  void set(int x, int y) { row(y)[x / word_bits] |= Word{ 1 } << (x % word_bits); }
+  // sets the pixels [x0, x1) of row y, which are clamped to the width
+  void set_run(int y, int x0, int x1);
+  // return the first set or unset pixel of row y at or right of x, or the width
+  int find_set(int y, int x) const;
+  int find_unset(int y, int x) const;
+
+private:
+  size_t row_offset(int y) const {
+    return static_cast<size_t>(y) * static_cast<size_t>(m_words_per_row);
+  }
+
+  int m_width{ };
+  int m_height{ };
+  int m_words_per_row{ };
+  std::vector<Word> m_words;
+};
+
+// index of the pixels with an alpha or gray level of at least threshold,
+// which answers the used pixel queries without scanning pixels. it consists
+// of a mask of the used pixels and a summed-area table of the tiles
+// containing used pixels, so the mask is only tested at a rect's edges.
+// only the pixels within rect are indexed, which is the whole image when empty
+class OccupancyIndex {
+public:
+  static constexpr int tile_size = 16;
+
+  OccupancyIndex(const ImageView& image, bool gray_levels, int threshold,
+    const Rect& rect = { });
+
+  bool gray_levels() const { return m_gray_levels; }
+  int threshold() const { return m_threshold; }
+  Rect bounds() const { return { m_origin.x, m_origin.y, m_mask.width(), m_mask.height() }; }
+  bool is_unused(const Rect& rect) const;
+  // like the other functions taking a rect, an empty rect selects the bounds
+  Rect get_used_bounds(const Rect& rect = { }) const;
+
+private:
+  // number of used tiles in the tile columns [x0, x1) and rows [y0, y1)
+  uint32_t count_used_tiles(int x0, int y0, int x1, int y1) const;
+  // rect is relative to the origin
+  bool is_used(const Rect& rect) const;
+  bool is_used_in_mask(const Rect& rect) const;
+
+  Point m_origin{ };
+  MonoMask m_mask;
+  int m_tile_columns{ };
+  int m_tile_rows{ };
+  std::vector<uint32_t> m_tile_sums;
+  bool m_gray_levels{ };
+  int m_threshold{ };
+};
+
+// a run of pixels [x0, x1) in row y
+struct RowSpan {
+  int y;
+  int x0;
+  int x1;
+};
+
 void save_image(const Image& image, const std::filesystem::path& filename);
-void copy_rect(const Image& source, const Rect& source_rect, Image& dest, int dx, int dy);
-void copy_rect_rotated_cw(const Image& source, const Rect& source_rect, Image& dest, int dx, int dy);
-void copy_rect(const Image& source, const Rect& source_rect, Image& dest, int dx, int dy, const std::vector<PointF>& mask_vertices);
-void copy_rect_rotated_cw(const Image& source, const Rect& source_rect, Image& dest, int dx, int dy, const std::vector<PointF>& mask_vertices);
+// per pixel alpha processing, which can be applied while copying
+enum class AlphaFilter { none, clear, premultiply, opaque };
+
+void copy_rect(const ImageView& source, const Rect& source_rect, Image& dest, int dx, int dy,
+  AlphaFilter filter = AlphaFilter::none, RGBA background = { });
+void copy_rect_rotated_cw(const ImageView& source, const Rect& source_rect, Image& dest, int dx, int dy,
+  AlphaFilter filter = AlphaFilter::none, RGBA background = { });
+void copy_rect(const ImageView& source, const Rect& source_rect, Image& dest, int dx, int dy,
+  const std::vector<RowSpan>& mask_spans, AlphaFilter filter = AlphaFilter::none, RGBA background = { });
+void copy_rect_rotated_cw(const ImageView& source, const Rect& source_rect, Image& dest, int dx, int dy,
+  const std::vector<RowSpan>& mask_spans, AlphaFilter filter = AlphaFilter::none, RGBA background = { });
+std::vector<RowSpan> get_polygon_spans(const std::vector<PointF>& vertices, int width, int height);
 void extrude_rect(Image& image, const Rect& rect, bool left, bool top, bool right, bool bottom);
 void draw_rect(Image& image, const Rect& rect, const RGBA& color);
 void draw_line(Image& image, int x0, int y0, int x1, int y1, const RGBA& color, bool omit_last = false);
 void fill_rect(Image& image, const Rect& rect, const RGBA& color);
-bool is_opaque(const Image& image, const Rect& rect = { });
-bool is_fully_transparent(const Image& image, int threshold = 1, const Rect& rect = { });
-bool is_fully_black(const Image& image, int threshold = 1, const Rect& rect = { });
-bool is_identical(const Image& image_a, const Rect& rect_a, const Image& image_b, const Rect& rect_b);
-Rect get_used_bounds(const Image& image, bool gray_levels, int threshold = 1, const Rect& rect = { });
+bool is_opaque(const ImageView& image, const Rect& rect = { });
+bool is_fully_transparent(const ImageView& image, int threshold = 1, const Rect& rect = { });
+bool is_fully_black(const ImageView& image, int threshold = 1, const Rect& rect = { });
+bool is_identical(const ImageView& image_a, const Rect& rect_a, const ImageView& image_b, const Rect& rect_b);
+uint64_t get_pixel_hash(const ImageView& image, const Rect& rect);
+Rect get_used_bounds(const ImageView& image, bool gray_levels, int threshold = 1, const Rect& rect = { });
 RGBA guess_colorkey(const Image& image);
 void replace_color(Image& image, RGBA original, RGBA color);
-std::vector<Rect> find_islands(const Image& image, int merge_distance, bool gray_levels, const Rect& rect = { });
+// an index of the image with a threshold of 1 can be passed for merging the islands
+std::vector<Rect> find_islands(const ImageView& image, int merge_distance, bool gray_levels,
+  const Rect& rect = { }, const OccupancyIndex* index = nullptr);
+void filter_alpha(RGBA* pixels, int count, AlphaFilter filter, RGBA background = { });
 void clear_alpha(Image& image);
 void make_opaque(Image& image, RGBA background);
 void premultiply_alpha(Image& image);
-void bleed_alpha(Image& image);
-MonoImage get_alpha_levels(const Image& image, const Rect& rect = { });
-MonoImage get_gray_levels(const Image& image, const Rect& rect = { });
+// when radius is not zero, only pixels within the distance are filled.
+// when regions are passed, all non-transparent pixels must be inside them
+void bleed_alpha(Image& image, int radius = 0, const std::vector<Rect>& regions = { });
+MonoImage get_alpha_levels(const ImageView& image, const Rect& rect = { });
+MonoImage get_gray_levels(const ImageView& image, const Rect& rect = { });
+// the pixels with an alpha or gray level of at least threshold
+MonoMask get_used_mask(const ImageView& image, bool gray_levels, int threshold);
 
 } // namespace
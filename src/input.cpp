@@ -9,7 +9,13 @@
 namespace spright {
 
 std::vector<Sprite> parse_definition(const Settings& settings) {
-  auto parser = InputParser(settings);
+  auto context = InputContext{ };
+  return parse_definition(settings, context);
+}
+
+std::vector<Sprite> parse_definition(const Settings& settings,
+    InputContext& context) {
+  auto parser = InputParser(settings, &context);
 
   if (!settings.input.empty()) {
     auto input = std::stringstream(settings.input);
@@ -23,6 +29,7 @@ std::vector<Sprite> parse_definition(const Settings& settings) {
       continue;;
     }
 
+    context.dependencies.insert(std::filesystem::weakly_canonical(input_file));
     auto input = std::fstream(input_file, std::ios::in | std::ios::binary);
     if (!input.good())
       throw std::runtime_error("opening file '" + path_to_utf8(input_file) + "' failed");
@@ -5,21 +5,30 @@
 #include "FilenameSequence.h"
 #include <memory>
 #include <map>
+#include <set>
+#include <future>
+
+#if __cplusplus > 201703L && __has_include(<span>)
+# include <span>
+#else
+# include "libs/nonstd/span.hpp"
+#endif
 
 namespace spright {
 
 using ImagePtr = std::shared_ptr<const Image>;
+using OccupancyPtr = std::shared_ptr<const OccupancyIndex>;
 using TexturePtr = std::shared_ptr<const struct Texture>;
 
 enum class PivotX { left, center, right, custom };
 enum class PivotY { top, middle, bottom, custom };
 struct Pivot { PivotX x; PivotY y; };
 
-enum class Trim { none, rect, convex };
+enum class Trim { none, rect, convex, mesh };
 
 enum class Alpha { keep, clear, bleed, premultiply, colorkey };
 
-enum class Pack { binpack, compact, single, keep };
+enum class Pack { binpack, compact, single, keep, best };
 
 enum class Duplicates { keep, share, drop };
 
@@ -38,6 +47,7 @@ struct Texture {
   Duplicates duplicates{ };
   Alpha alpha{ Alpha::keep };
   RGBA colorkey{ };
+  int bleed_radius{ };
   Pack pack{ Pack::binpack };
 };
 
@@ -46,6 +56,11 @@ struct Sprite {
   std::string id;
   TexturePtr texture;
   ImagePtr source;
+  std::shared_future<void> source_loaded;
+  // colorkey which was replaced when the source was decoded
+  RGBA source_colorkey{ };
+  // set when the sheet was indexed with the sprite's trim threshold
+  OccupancyPtr source_occupancy;
   Rect source_rect{ };
   Rect trimmed_source_rect{ };
   Rect rect{ };
@@ -56,6 +71,7 @@ struct Sprite {
   int trim_margin{ };
   int trim_threshold{ };
   bool trim_gray_levels{ };
+  int trim_max_vertices{ };
   bool crop{ };
   int extrude{ };
   std::map<std::string, std::string> tags;
@@ -65,8 +81,35 @@ struct Sprite {
   Point common_divisor_offset{ };
   Size common_divisor_margin{ };
   std::vector<PointF> vertices;
+  // indices of the vertices, three per triangle
+  std::vector<int> triangles;
+  std::vector<RowSpan> mask_spans;
+  uint64_t trimmed_hash{ };
+};
+
+#if !defined(NONSTD_SPAN_HPP_INCLUDED)
+using SpriteSpan = std::span<Sprite>;
+#else
+using SpriteSpan = nonstd::span<Sprite>;
+#endif
+
+struct Sheet {
+  ImagePtr image;
+  RGBA colorkey{ };
+  std::shared_future<void> loaded;
+  // built on first use, when the sheet's grid cells are classified
+  OccupancyPtr occupancy;
+};
+
+// decoded sheets and the files the definition depends on,
+// which are kept between runs in watch mode
+struct InputContext {
+  std::map<std::filesystem::path, Sheet> sheets;
+  std::set<std::filesystem::path> dependencies;
 };
 
 std::vector<Sprite> parse_definition(const Settings& settings);
+std::vector<Sprite> parse_definition(const Settings& settings,
+  InputContext& context);
 
 } // namespace
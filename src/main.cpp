@@ -2,8 +2,169 @@
 #include "trimming.h"
 #include "packing.h"
 #include "output.h"
+#include "caching.h"
+#include "watching.h"
+#include "stats.h"
+#include "ThreadPool.h"
 #include <iostream>
 #include <chrono>
+#include <numeric>
+#include <optional>
+
+namespace spright {
+
+namespace {
+  void save_textures(const Settings& settings,
+      const std::vector<PackedTexture>& textures) {
+    // start with the biggest textures, to not end with a single busy thread
+    auto texture_order = std::vector<const PackedTexture*>();
+    for (const auto& texture : textures)
+      texture_order.push_back(&texture);
+    std::stable_sort(begin(texture_order), end(texture_order),
+      [](const PackedTexture* a, const PackedTexture* b) {
+        return (a->width * a->height > b->width * b->height);
+      });
+
+    for_each_parallel(begin(texture_order), end(texture_order),
+      [&](const PackedTexture* texture) {
+        const auto image = get_output_texture(settings, *texture);
+        auto scope = StageScope(Stage::encode, path_to_utf8(texture->filename));
+        save_image(image, settings.output_path / texture->filename);
+      });
+  }
+
+  // the sprites of each output texture are trimmed, packed and saved
+  // as soon as their sheets are decoded, independent of the other textures.
+  // unchanged textures are restored from the cache, when one is set
+  std::vector<PackedTexture> process_sprites(const Settings& settings,
+      std::vector<Sprite>& sprites, BuildCache* cache) {
+    const auto groups = sort_sprites_by_texture(sprites);
+
+    auto group_order = std::vector<size_t>(groups.size());
+    std::iota(begin(group_order), end(group_order), size_t{ });
+    std::stable_sort(begin(group_order), end(group_order),
+      [&](size_t a, size_t b) { return groups[a].size() > groups[b].size(); });
+
+    auto packed_groups = std::vector<std::vector<PackedTexture>>(groups.size());
+    for_each_parallel(begin(group_order), end(group_order),
+      [&](size_t index) {
+        auto key = CacheKey{ };
+        if (cache) {
+          key = cache->get_key(groups[index]);
+          if (cache->restore(key, groups[index], packed_groups[index]))
+            return;
+        }
+        trim_sprites(groups[index]);
+        pack_texture_sprites(groups[index], packed_groups[index]);
+        save_textures(settings, packed_groups[index]);
+        if (cache)
+          cache->store(key, groups[index], packed_groups[index]);
+      });
+
+    auto textures = std::vector<PackedTexture>();
+    for (auto& packed_group : packed_groups)
+      std::move(begin(packed_group), end(packed_group),
+        std::back_inserter(textures));
+    return textures;
+  }
+
+  // returns the written output files
+  std::vector<std::filesystem::path> build(const Settings& settings,
+      InputContext& context, BuildCache* cache) {
+    using Clock = std::chrono::high_resolution_clock;
+    auto time_points = std::vector<Clock::time_point>();
+    const auto add_time_point = [&]() { time_points.push_back(Clock::now()); };
+    add_time_point();
+    if (stats_enabled())
+      reset_stats();
+    if (trace_enabled())
+      reset_trace();
+
+    auto sprites = std::vector<Sprite>();
+    {
+      auto scope = StageScope(Stage::parse);
+      sprites = parse_definition(settings, context);
+    }
+    add_time_point();
+
+    const auto textures = process_sprites(settings, sprites, cache);
+    add_time_point();
+
+    write_output_description(settings, sprites, textures);
+    if (cache)
+      cache->remove_unused();
+    add_time_point();
+
+    if (stats_enabled())
+      write_stats(settings, sprites, textures);
+    if (trace_enabled())
+      write_trace(settings);
+
+    if (settings.debug) {
+      auto time_it = time_points.begin();
+      const auto time_elapsed = [&]() {
+        const auto start = *time_it++;
+        const auto stop = *time_it;
+        return std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+      };
+      std::cout <<
+        "input: " << time_elapsed() << "ms, " <<
+        "trimming, packing and output textures: " << time_elapsed() << "ms, " <<
+        "output description: " << time_elapsed() << "ms" <<
+        std::endl;
+    }
+
+    auto outputs = std::vector<std::filesystem::path>();
+    for (const auto& texture : textures)
+      outputs.push_back(settings.output_path / texture.filename);
+    outputs.push_back(settings.output_path / settings.output_file);
+    return outputs;
+  }
+
+  // rebuilds whenever a dependency changes. decoded sheets and the results
+  // of unchanged output textures are kept in memory
+  void watch(const Settings& settings, InputContext& context, BuildCache& cache) {
+    const auto cache_path = (settings.cache_path.empty() ?
+      std::filesystem::path() : std::filesystem::weakly_canonical(settings.cache_path));
+    auto outputs = std::set<std::filesystem::path>();
+    const auto ignore = [&](const std::filesystem::path& filename) {
+      if (outputs.count(filename))
+        return true;
+      return (!cache_path.empty() && std::mismatch(cache_path.begin(), cache_path.end(),
+        filename.begin(), filename.end()).first == cache_path.end());
+    };
+
+    auto watcher = FileWatcher();
+    for (;;) {
+      outputs.clear();
+      context.dependencies.clear();
+      try {
+        for (const auto& output : build(settings, context, &cache))
+          outputs.insert(std::filesystem::weakly_canonical(output));
+      }
+      catch (const std::exception& ex) {
+        std::cerr << ex.what() << std::endl;
+      }
+
+      if (!settings.template_file.empty())
+        context.dependencies.insert(
+          std::filesystem::weakly_canonical(settings.template_file));
+
+      // release sheets which are no longer used
+      for (auto it = context.sheets.begin(); it != context.sheets.end(); )
+        it = (context.dependencies.count(it->first) ?
+          std::next(it) : context.sheets.erase(it));
+
+      watcher.watch(context.dependencies);
+      for (const auto& filename : watcher.wait_for_changes(ignore)) {
+        context.sheets.erase(filename);
+        cache.invalidate(filename);
+      }
+    }
+  }
+} // namespace
+
+} // namespace
 
 int main(int argc, const char* argv[]) try {
   using namespace spright;
@@ -18,46 +179,21 @@ int main(int argc, const char* argv[]) try {
     return 1;
   }
 
-  using Clock = std::chrono::high_resolution_clock;
-  auto time_points = std::vector<Clock::time_point>();
-  const auto add_time_point = [&]() { time_points.push_back(Clock::now()); };
-  add_time_point();
-
-  auto sprites = parse_definition(settings);  
-  add_time_point();
-
-  for (auto& sprite : sprites)
-    trim_sprite(sprite);
-  add_time_point();
-
-  const auto textures = pack_sprites(sprites);
-  add_time_point();
-
-  write_output_description(settings, sprites, textures);
-  add_time_point();
-
-  for_each_parallel(begin(textures), end(textures),
-    [&](const PackedTexture& texture) {
-      save_image(get_output_texture(settings, texture),
-        settings.output_path / texture.filename);
-    });
-  add_time_point();
-
-  if (settings.debug) {
-    auto time_it = time_points.begin();
-    const auto time_elapsed = [&]() {
-      const auto start = *time_it++;
-      const auto stop = *time_it;
-      return std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
-    };
-    std::cout <<
-      "input: " << time_elapsed() << "ms, " <<
-      "trimming: " << time_elapsed() << "ms, " <<
-      "packing: " << time_elapsed() << "ms, " <<
-      "output description: " << time_elapsed() << "ms, " <<
-      "output textures: " << time_elapsed() << "ms" <<
-      std::endl;
-  }
+  set_thread_pool_size(settings.jobs);
+  if (!settings.stats_file.empty())
+    enable_stats();
+  if (!settings.trace_file.empty())
+    enable_trace();
+
+  auto context = InputContext{ };
+  auto cache = std::optional<BuildCache>();
+  if (!settings.cache_path.empty() || settings.watch)
+    cache.emplace(settings);
+
+  if (settings.watch)
+    watch(settings, context, *cache);
+  else
+    build(settings, context, (cache ? &*cache : nullptr));
   return 0;
 }
 catch (const std::exception& ex) {
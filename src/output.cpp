@@ -1,5 +1,6 @@
 
 #include "output.h"
+#include "stats.h"
 #include "inja/inja.hpp"
 #include <fstream>
 
@@ -67,6 +68,8 @@ namespace {
         tags[tag_key].push_back(index);
       if (!sprite.vertices.empty())
         json_sprite["vertices"] = json_point_list(sprite.vertices);
+      if (!sprite.triangles.empty())
+        json_sprite["triangles"] = sprite.triangles;
       texture_sprites[texture_filename].push_back(index);
     }
 
@@ -128,26 +131,29 @@ namespace {
     return env;
   }
 
-  void copy_sprite(Image& target, const Sprite& sprite) try {
+  void copy_sprite(Image& target, const Sprite& sprite,
+      AlphaFilter filter, RGBA background) try {
 
     if (sprite.rotated) {
       if (sprite.vertices.empty()) {
         copy_rect_rotated_cw(*sprite.source, sprite.trimmed_source_rect,
-          target, sprite.trimmed_rect.x, sprite.trimmed_rect.y);
+          target, sprite.trimmed_rect.x, sprite.trimmed_rect.y, filter, background);
       }
       else {
         copy_rect_rotated_cw(*sprite.source, sprite.trimmed_source_rect,
-          target, sprite.trimmed_rect.x, sprite.trimmed_rect.y, sprite.vertices);
+          target, sprite.trimmed_rect.x, sprite.trimmed_rect.y, sprite.mask_spans,
+          filter, background);
       }
     }
     else {
       if (sprite.vertices.empty()) {
         copy_rect(*sprite.source, sprite.trimmed_source_rect,
-          target, sprite.trimmed_rect.x, sprite.trimmed_rect.y);
+          target, sprite.trimmed_rect.x, sprite.trimmed_rect.y, filter, background);
       }
       else {
         copy_rect(*sprite.source, sprite.trimmed_source_rect,
-          target, sprite.trimmed_rect.x, sprite.trimmed_rect.y, sprite.vertices);
+          target, sprite.trimmed_rect.x, sprite.trimmed_rect.y, sprite.mask_spans,
+          filter, background);
       }
     }
 
@@ -175,27 +181,28 @@ namespace {
 #endif
   }
 
-  void process_alpha(Image& target, const PackedTexture& texture) {
-    switch (texture.alpha) {
-      case Alpha::keep:
-        break;
-
-      case Alpha::clear:
-        clear_alpha(target);
-        break;
-
-      case Alpha::bleed:
-        bleed_alpha(target);
-        break;
-
-      case Alpha::premultiply:
-        premultiply_alpha(target);
-        break;
+  // all but bleeding is applied per pixel while copying the sprites
+  AlphaFilter get_alpha_filter(Alpha alpha) {
+    switch (alpha) {
+      case Alpha::keep: break;
+      case Alpha::clear: return AlphaFilter::clear;
+      case Alpha::bleed: break;
+      case Alpha::premultiply: return AlphaFilter::premultiply;
+      case Alpha::colorkey: return AlphaFilter::opaque;
+    }
+    return AlphaFilter::none;
+  }
 
-      case Alpha::colorkey:
-        make_opaque(target, texture.colorkey);
-        break;
+  // the rects containing all the pixels copied for the sprites
+  std::vector<Rect> get_sprite_regions(const PackedTexture& texture) {
+    auto regions = std::vector<Rect>();
+    for (const auto& sprite : texture.sprites) {
+      auto rect = sprite.trimmed_rect;
+      if (sprite.rotated)
+        std::swap(rect.w, rect.h);
+      regions.push_back(expand(rect, sprite.extrude));
     }
+    return regions;
   }
 
   void draw_debug_info(Image& target, const Sprite& sprite) {
@@ -223,9 +230,19 @@ namespace {
     if (!sprite.vertices.empty()) {
       const auto x = static_cast<float>(sprite.trimmed_rect.x);
       const auto y = static_cast<float>(sprite.trimmed_rect.y);
-      for (auto i = 0u; i < sprite.vertices.size(); i++) {
-        const auto& v0 = sprite.vertices[i];
-        const auto& v1 = sprite.vertices[(i + 1) % sprite.vertices.size()];
+      // draw the edges of the triangles or of the outline
+      const auto edges = (sprite.triangles.empty() ?
+        sprite.vertices.size() : sprite.triangles.size());
+      const auto vertex = [&](size_t index) -> const PointF& {
+        if (sprite.triangles.empty())
+          return sprite.vertices[index % sprite.vertices.size()];
+        const auto triangle = index / 3 * 3;
+        return sprite.vertices[static_cast<size_t>(
+          sprite.triangles[triangle + index % 3])];
+      };
+      for (auto i = size_t{ }; i < edges; i++) {
+        const auto& v0 = vertex(i);
+        const auto& v1 = vertex(sprite.triangles.empty() ? i + 1 : i / 3 * 3 + (i + 1) % 3);
         draw_line(target,
           static_cast<int>(x + v0.x),
           static_cast<int>(y + v0.y),
@@ -275,11 +292,20 @@ void write_output_description(const Settings& settings,
 }
 
 Image get_output_texture(const Settings& settings, const PackedTexture& texture) {
-  auto target = Image(texture.width, texture.height, RGBA{ });
-  for (const auto& sprite : texture.sprites)
-    copy_sprite(target, sprite);
-
-  process_alpha(target, texture);
+  const auto filename = path_to_utf8(texture.filename);
+  const auto filter = get_alpha_filter(texture.alpha);
+  // the filtered value of the transparent pixels between the sprites
+  const auto background = (filter == AlphaFilter::opaque ? texture.colorkey : RGBA{ });
+  auto target = Image(texture.width, texture.height, background);
+  {
+    auto scope = StageScope(Stage::compose, filename);
+    for (const auto& sprite : texture.sprites)
+      copy_sprite(target, sprite, filter, background);
+  }
+  if (texture.alpha == Alpha::bleed) {
+    auto scope = StageScope(Stage::alpha, filename);
+    bleed_alpha(target, texture.bleed_radius, get_sprite_regions(texture));
+  }
 
   if (settings.debug)
     for (const auto& sprite : texture.sprites)
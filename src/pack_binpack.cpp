@@ -1,25 +1,44 @@
 
 #include "packing.h"
 #include "rect_pack/rect_pack.h"
+#include <mutex>
+#include <tuple>
 
 namespace spright {
 
-void pack_binpack(const Texture& texture, SpriteSpan sprites,
-    bool fast, std::vector<PackedTexture>& packed_textures) {
-  // pack rects
-  auto pack_sizes = std::vector<rect_pack::Size>();
-  pack_sizes.reserve(sprites.size());
-  for (const auto& sprite : sprites) {
-    auto size = get_sprite_size(sprite);
-    size.x += texture.shape_padding;
-    size.y += texture.shape_padding;
-    pack_sizes.push_back({ static_cast<int>(pack_sizes.size()), size.x, size.y });
+namespace {
+  // orders in which the rects are passed to the packer
+  enum class SortOrder { none, area, longest_side };
+
+  struct Candidate {
+    rect_pack::Method method;
+    // index of the distinct sort order
+    size_t order;
+    int max_width;
+  };
+
+  // unpacked rects, sheets, total area and difference of the sides,
+  // lower is better
+  using Score = std::tuple<size_t, size_t, int64_t, int64_t>;
+
+  std::vector<rect_pack::Size> get_pack_sizes(const Texture& texture,
+      SpriteSpan sprites) {
+    auto pack_sizes = std::vector<rect_pack::Size>();
+    pack_sizes.reserve(sprites.size());
+    for (const auto& sprite : sprites) {
+      auto size = get_sprite_size(sprite);
+      size.x += texture.shape_padding;
+      size.y += texture.shape_padding;
+      pack_sizes.push_back({ static_cast<int>(pack_sizes.size()), size.x, size.y });
+    }
+    return pack_sizes;
   }
 
-  const auto [max_texture_width, max_texture_height] = get_texture_max_size(texture);
-  const auto pack_sheets = pack(
-    rect_pack::Settings{
-      (fast ? rect_pack::Method::Best_Skyline : rect_pack::Method::Best),
+  rect_pack::Settings get_pack_settings(const Texture& texture,
+      rect_pack::Method method) {
+    const auto [max_texture_width, max_texture_height] = get_texture_max_size(texture);
+    return {
+      method,
       texture.filename.count(),
       texture.power_of_two,
       texture.square,
@@ -31,61 +50,194 @@ void pack_binpack(const Texture& texture, SpriteSpan sprites,
       texture.height,
       max_texture_width,
       max_texture_height,
-    },
-    std::move(pack_sizes));
-
-  // update sprite rects
-  auto texture_index = 0;
-  auto packed_sprites = size_t{ };
-  for (const auto& pack_sheet : pack_sheets) {
-    for (const auto& pack_rect : pack_sheet.rects) {
-      auto& sprite = sprites[static_cast<size_t>(pack_rect.id)];
-      const auto indent = get_sprite_indent(sprite);
-      sprite.rotated = pack_rect.rotated;;
-      sprite.texture_index = texture_index;
-      sprite.trimmed_rect = {
-        pack_rect.x + indent.x,
-        pack_rect.y + indent.y,
-        sprite.trimmed_source_rect.w,
-        sprite.trimmed_source_rect.h
-      };
-      ++packed_sprites;
+    };
+  }
+
+  void sort_pack_sizes(std::vector<rect_pack::Size>& sizes, SortOrder order) {
+    const auto key = [&](const rect_pack::Size& size) -> int64_t {
+      if (order == SortOrder::area)
+        return int64_t{ size.width } * size.height;
+      return std::max(size.width, size.height);
+    };
+    if (order != SortOrder::none)
+      std::sort(sizes.begin(), sizes.end(),
+        [&](const rect_pack::Size& a, const rect_pack::Size& b) {
+          const auto ka = key(a);
+          const auto kb = key(b);
+          return (ka != kb ? ka > kb : a.id < b.id);
+        });
+  }
+
+  // the width of a square sheet with the area of the rects
+  int get_square_width(const Texture& texture,
+      const std::vector<rect_pack::Size>& sizes) {
+    auto area = int64_t{ };
+    auto min_width = texture.width;
+    for (const auto& size : sizes) {
+      area += int64_t{ size.width } * size.height;
+      min_width = std::max(min_width, (texture.allow_rotate ?
+        std::min(size.width, size.height) : size.width) + texture.border_padding * 2);
     }
-    ++texture_index;
+    auto width = std::max(static_cast<int>(std::ceil(std::sqrt(
+      static_cast<double>(area)))) + texture.border_padding * 2, min_width);
+    return (texture.power_of_two ? ceil_to_pot(width) : width);
   }
 
-  if (packed_sprites < sprites.size())
-    throw std::runtime_error("not all sprites could be packed");
-
-  // sort sprites by texture index
-  if (pack_sheets.size() > 1)
-    std::sort(std::begin(sprites), std::end(sprites),
-      [](const Sprite& a, const Sprite& b) {
-        return std::tie(a.texture_index, a.index) <
-               std::tie(b.texture_index, b.index);
-      });
-
-  // add to output textures
-  auto texture_begin = sprites.begin();
-  const auto end = sprites.end();
-  for (auto it = texture_begin;; ++it)
-    if (it == end || it->texture_index != texture_begin->texture_index) {
-      const auto sheet_index = texture_begin->texture_index;
-      const auto sheet_sprites = SpriteSpan(texture_begin, it);
-      const auto& pack_sheet = pack_sheets[static_cast<size_t>(sheet_index)];
-      packed_textures.push_back(PackedTexture{
-        texture.filename.get_nth_filename(sheet_index),
-        pack_sheet.width,
-        pack_sheet.height,
-        sheet_sprites,
-        texture.alpha,
-        texture.colorkey,
-      });
-
-      texture_begin = it;
-      if (it == end)
-        break;
+  Score get_score(const std::vector<rect_pack::Sheet>& sheets, size_t count) {
+    auto packed = size_t{ };
+    auto area = int64_t{ };
+    auto difference = int64_t{ };
+    for (const auto& sheet : sheets) {
+      packed += sheet.rects.size();
+      area += int64_t{ sheet.width } * sheet.height;
+      difference += std::abs(sheet.width - sheet.height);
+    }
+    return { count - std::min(packed, count), sheets.size(), area, difference };
+  }
+
+  void add_packed_textures(const Texture& texture, SpriteSpan sprites,
+      const std::vector<rect_pack::Sheet>& pack_sheets,
+      std::vector<PackedTexture>& packed_textures) {
+    // update sprite rects
+    auto texture_index = 0;
+    auto packed_sprites = size_t{ };
+    for (const auto& pack_sheet : pack_sheets) {
+      for (const auto& pack_rect : pack_sheet.rects) {
+        auto& sprite = sprites[static_cast<size_t>(pack_rect.id)];
+        const auto indent = get_sprite_indent(sprite);
+        sprite.rotated = pack_rect.rotated;
+        sprite.texture_index = texture_index;
+        sprite.trimmed_rect = {
+          pack_rect.x + indent.x,
+          pack_rect.y + indent.y,
+          sprite.trimmed_source_rect.w,
+          sprite.trimmed_source_rect.h
+        };
+        ++packed_sprites;
+      }
+      ++texture_index;
+    }
+
+    if (packed_sprites < sprites.size())
+      throw std::runtime_error("not all sprites could be packed");
+
+    // sort sprites by texture index
+    if (pack_sheets.size() > 1)
+      std::sort(std::begin(sprites), std::end(sprites),
+        [](const Sprite& a, const Sprite& b) {
+          return std::tie(a.texture_index, a.index) <
+                 std::tie(b.texture_index, b.index);
+        });
+
+    // add to output textures
+    auto texture_begin = sprites.begin();
+    const auto end = sprites.end();
+    for (auto it = texture_begin;; ++it)
+      if (it == end || it->texture_index != texture_begin->texture_index) {
+        const auto sheet_index = texture_begin->texture_index;
+        const auto sheet_sprites = SpriteSpan(texture_begin, it);
+        const auto& pack_sheet = pack_sheets[static_cast<size_t>(sheet_index)];
+        packed_textures.push_back(PackedTexture{
+          texture.filename.get_nth_filename(sheet_index),
+          pack_sheet.width,
+          pack_sheet.height,
+          sheet_sprites,
+          texture.alpha,
+          texture.colorkey,
+          texture.bleed_radius,
+        });
+
+        texture_begin = it;
+        if (it == end)
+          break;
+      }
+  }
+} // namespace
+
+void pack_binpack(const Texture& texture, SpriteSpan sprites,
+    bool fast, std::vector<PackedTexture>& packed_textures) {
+  const auto pack_sheets = pack(
+    get_pack_settings(texture,
+      (fast ? rect_pack::Method::Best_Skyline : rect_pack::Method::Best)),
+    get_pack_sizes(texture, sprites));
+  add_packed_textures(texture, sprites, pack_sheets, packed_textures);
+}
+
+void pack_best(const Texture& texture, SpriteSpan sprites,
+    bool fast, std::vector<PackedTexture>& packed_textures) {
+  // a single sprite is placed the same way by every candidate
+  if (sprites.size() < 2)
+    return pack_binpack(texture, sprites, fast, packed_textures);
+
+  const auto pack_sizes = get_pack_sizes(texture, sprites);
+
+  // width limits are only tried when the width is not fixed,
+  // otherwise every limit above it results in the same sheets
+  const auto max_width = get_texture_max_size(texture).first;
+  auto widths = std::vector<int>{ 0 };
+  if (const auto width = get_square_width(texture, pack_sizes);
+      !texture.width && width < max_width) {
+    widths.push_back(width);
+    const auto wider = (texture.power_of_two ? width * 2 : width + width / 4);
+    if (wider > width && wider < max_width)
+      widths.push_back(wider);
+  }
+
+  // orders which result in the same sequence are only tried once
+  auto orders = std::vector<std::vector<rect_pack::Size>>();
+  for (auto order : { SortOrder::none, SortOrder::area, SortOrder::longest_side }) {
+    auto sizes = pack_sizes;
+    sort_pack_sizes(sizes, order);
+    const auto same_sequence = [&](const std::vector<rect_pack::Size>& other) {
+      return std::equal(sizes.begin(), sizes.end(), other.begin(),
+        [](const rect_pack::Size& a, const rect_pack::Size& b) { return a.id == b.id; });
+    };
+    if (std::none_of(orders.begin(), orders.end(), same_sequence))
+      orders.push_back(std::move(sizes));
+  }
+
+  // the method of binpack comes first, so the result is never worse.
+  // the skyline methods sort the rects by height, so only the
+  // MaxRects methods are tried with every order
+  auto candidates = std::vector<Candidate>();
+  candidates.push_back({ (fast ?
+    rect_pack::Method::Best_Skyline : rect_pack::Method::Best), 0, 0 });
+  for (auto width : widths) {
+    for (auto method : { rect_pack::Method::Skyline_BottomLeft,
+                         rect_pack::Method::Skyline_BestFit })
+      candidates.push_back({ method, 0, width });
+    for (auto method : { rect_pack::Method::MaxRects_BestShortSideFit,
+                         rect_pack::Method::MaxRects_BestLongSideFit,
+                         rect_pack::Method::MaxRects_BestAreaFit,
+                         rect_pack::Method::MaxRects_BottomLeftRule,
+                         rect_pack::Method::MaxRects_ContactPointRule })
+      for (auto order = size_t{ }; order < orders.size(); ++order)
+        candidates.push_back({ method, order, width });
+  }
+
+  // only the best result so far is kept,
+  // ties are broken by the order of the candidates
+  auto mutex = std::mutex();
+  auto best_index = candidates.size();
+  auto best_score = Score{ };
+  auto best_sheets = std::vector<rect_pack::Sheet>();
+  for_each_parallel(candidates.size(), [&](size_t index) {
+    const auto& candidate = candidates[index];
+    auto settings = get_pack_settings(texture, candidate.method);
+    if (candidate.max_width)
+      settings.max_width = candidate.max_width;
+    auto sheets = pack(settings, orders[candidate.order]);
+    const auto score = get_score(sheets, pack_sizes.size());
+
+    auto lock = std::lock_guard(mutex);
+    if (best_index == candidates.size() ||
+        std::tie(score, index) < std::tie(best_score, best_index)) {
+      best_index = index;
+      best_score = score;
+      best_sheets = std::move(sheets);
     }
+  });
+  add_packed_textures(texture, sprites, best_sheets, packed_textures);
 }
 
 } // namespace
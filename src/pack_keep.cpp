@@ -23,6 +23,7 @@ void pack_keep(const Texture& texture, SpriteSpan sprites,
     sprites,
     texture.alpha,
     texture.colorkey,
+    texture.bleed_radius,
   });
 }
 
@@ -34,6 +34,7 @@ void pack_single(const Texture& texture, SpriteSpan sprites,
       { &sprite, 1 },
       texture.alpha,
       texture.colorkey,
+      texture.bleed_radius,
     });
   }
 }
@@ -1,5 +1,8 @@
 
 #include "packing.h"
+#include "stats.h"
+#include <numeric>
+#include <unordered_map>
 
 namespace spright {
 
@@ -20,6 +23,30 @@ namespace {
     return std::numeric_limits<int>::max();
   }
 
+  // the union of the spans of the triangles
+  std::vector<RowSpan> get_triangle_spans(const std::vector<PointF>& vertices,
+      const std::vector<int>& triangles, int width, int height) {
+    auto spans = std::vector<RowSpan>();
+    for (auto i = size_t{ }; i + 2 < triangles.size(); i += 3) {
+      const auto triangle = get_polygon_spans({
+        vertices[static_cast<size_t>(triangles[i])],
+        vertices[static_cast<size_t>(triangles[i + 1])],
+        vertices[static_cast<size_t>(triangles[i + 2])] }, width, height);
+      spans.insert(spans.end(), triangle.begin(), triangle.end());
+    }
+    std::sort(spans.begin(), spans.end(), [](const RowSpan& a, const RowSpan& b) {
+      return std::tie(a.y, a.x0) < std::tie(b.y, b.x0);
+    });
+    auto merged = std::vector<RowSpan>();
+    for (const auto& span : spans)
+      if (!merged.empty() && merged.back().y == span.y &&
+          merged.back().x1 >= span.x0)
+        merged.back().x1 = std::max(merged.back().x1, span.x1);
+      else
+        merged.push_back(span);
+    return merged;
+  }
+
   void prepare_sprite(Sprite& sprite) {
     const auto distance_to_next_multiple =
       [](int value, int divisor) { return ceil(value, divisor) - value; };
@@ -69,6 +96,8 @@ namespace {
     if (sprite.rotated)
       for (auto& vertex : sprite.vertices)
         std::swap(vertex.x, vertex.y);
+
+    update_mask_spans(sprite);
   }
 
   void pack_texture(const Texture& texture,
@@ -80,6 +109,7 @@ namespace {
       case Pack::compact: return pack_compact(texture, sprites, packed_textures);
       case Pack::single: return pack_single(texture, sprites, packed_textures);
       case Pack::keep: return pack_keep(texture, sprites, packed_textures);
+      case Pack::best: return pack_best(texture, sprites, sprites.size() > 1000, packed_textures);
     }
   }
 
@@ -90,16 +120,30 @@ namespace {
     // sort duplicates to back
     auto unique_sprites = sprites;
     auto duplicates = std::vector<size_t>();
-    for (auto i = size_t{ }; i < unique_sprites.size(); ++i) {
-      for (auto j = size_t{ }; j < i; ++j)
-        if (is_identical(*sprites[i].source, sprites[i].trimmed_source_rect,
-                         *sprites[j].source, sprites[j].trimmed_source_rect)) {
+    {
+      auto scope = StageScope(Stage::deduplicate, texture.filename.filename());
+      const auto get_hash = [](const Sprite& sprite) {
+        return (sprite.trimmed_hash ? sprite.trimmed_hash :
+          get_pixel_hash(*sprite.source, sprite.trimmed_source_rect));
+      };
+      // only sprites with the same hash are compared, lowest index first
+      auto buckets = std::unordered_map<uint64_t, std::vector<size_t>>();
+      for (auto i = size_t{ }; i < unique_sprites.size(); ++i) {
+        auto& bucket = buckets[get_hash(sprites[i])];
+        const auto it = std::find_if(bucket.begin(), bucket.end(), [&](size_t j) {
+          return is_identical(*sprites[i].source, sprites[i].trimmed_source_rect,
+                              *sprites[j].source, sprites[j].trimmed_source_rect);
+        });
+        if (it != bucket.end()) {
           std::swap(sprites[i--], unique_sprites.back());
           unique_sprites = unique_sprites.first(unique_sprites.size() - 1);
-          duplicates.emplace_back(j);
-          break;
+          duplicates.emplace_back(*it);
+        }
+        else {
+          bucket.push_back(i);
         }
-       }
+      }
+    }
 
     pack_texture(texture, unique_sprites, packed_textures);
 
@@ -116,32 +160,6 @@ namespace {
       }
     }
   }
-
-  void pack_sprites_by_texture(SpriteSpan sprites, std::vector<PackedTexture>& packed_textures) {
-    if (sprites.empty())
-      return;
-
-    // sort sprites by texture
-    std::sort(std::begin(sprites), std::end(sprites),
-      [](const Sprite& a, const Sprite& b) {
-        return std::tie(a.texture->filename, a.index) <
-               std::tie(b.texture->filename, b.index);
-      });
-
-    for (auto begin = sprites.begin(), it = begin; ; ++it)
-      if (it == sprites.end() ||
-          it->texture->filename != begin->texture->filename) {
-        auto& texture = *begin->texture;
-        if (texture.duplicates != Duplicates::keep)
-          pack_texture_deduplicate(texture, { begin, it }, packed_textures);
-        else
-          pack_texture(texture, { begin, it }, packed_textures);
-
-        if (it == sprites.end())
-          break;
-        begin = it;
-      }
-  }
 } // namespace
 
 std::pair<int, int> get_texture_max_size(const Texture& texture) {
@@ -165,16 +183,81 @@ Size get_sprite_indent(const Sprite& sprite) {
   };
 }
 
-std::vector<PackedTexture> pack_sprites(std::vector<Sprite>& sprites) {
+void update_mask_spans(Sprite& sprite) {
+  sprite.mask_spans.clear();
+  if (sprite.vertices.empty())
+    return;
+  // vertices are in texture orientation
+  const auto w = sprite.trimmed_source_rect.w;
+  const auto h = sprite.trimmed_source_rect.h;
+  if (!sprite.triangles.empty())
+    sprite.mask_spans = (sprite.rotated ?
+      get_triangle_spans(sprite.vertices, sprite.triangles, h, w) :
+      get_triangle_spans(sprite.vertices, sprite.triangles, w, h));
+  else
+    sprite.mask_spans = (sprite.rotated ?
+      get_polygon_spans(sprite.vertices, h, w) :
+      get_polygon_spans(sprite.vertices, w, h));
+}
+
+std::vector<SpriteSpan> sort_sprites_by_texture(std::vector<Sprite>& sprites) {
+  std::sort(std::begin(sprites), std::end(sprites),
+    [](const Sprite& a, const Sprite& b) {
+      return std::tie(a.texture->filename, a.index) <
+             std::tie(b.texture->filename, b.index);
+    });
+
+  auto groups = std::vector<SpriteSpan>();
+  if (sprites.empty())
+    return groups;
+
+  for (auto begin = sprites.begin(), it = begin; ; ++it)
+    if (it == sprites.end() ||
+        it->texture->filename != begin->texture->filename) {
+      groups.emplace_back(&*begin, static_cast<size_t>(std::distance(begin, it)));
+      if (it == sprites.end())
+        break;
+      begin = it;
+    }
+  return groups;
+}
+
+void pack_texture_sprites(SpriteSpan sprites, std::vector<PackedTexture>& packed_textures) {
+  if (sprites.empty())
+    return;
+
+  const auto& texture = *sprites.front().texture;
+  auto scope = StageScope(Stage::pack, texture.filename.filename());
+
   for (auto& sprite : sprites)
     prepare_sprite(sprite);
 
-  auto packed_textures = std::vector<PackedTexture>();
-  pack_sprites_by_texture(sprites, packed_textures);
+  if (texture.duplicates != Duplicates::keep)
+    pack_texture_deduplicate(texture, sprites, packed_textures);
+  else
+    pack_texture(texture, sprites, packed_textures);
 
   for (auto& sprite : sprites)
     complete_sprite(sprite);
+}
+
+std::vector<PackedTexture> pack_sprites(std::vector<Sprite>& sprites) {
+  const auto groups = sort_sprites_by_texture(sprites);
 
+  // pack groups in parallel, starting with the biggest
+  auto group_order = std::vector<size_t>(groups.size());
+  std::iota(group_order.begin(), group_order.end(), size_t{ });
+  std::stable_sort(group_order.begin(), group_order.end(),
+    [&](size_t a, size_t b) { return groups[a].size() > groups[b].size(); });
+
+  auto packed_groups = std::vector<std::vector<PackedTexture>>(groups.size());
+  for_each_parallel(group_order.begin(), group_order.end(),
+    [&](size_t index) { pack_texture_sprites(groups[index], packed_groups[index]); });
+
+  auto packed_textures = std::vector<PackedTexture>();
+  for (auto& packed_group : packed_groups)
+    std::move(packed_group.begin(), packed_group.end(),
+      std::back_inserter(packed_textures));
   return packed_textures;
 }
 
@@ -2,20 +2,8 @@
 
 #include "input.h"
 
-#if __cplusplus > 201703L && __has_include(<span>)
-# include <span>
-#else
-# include "libs/nonstd/span.hpp"
-#endif
-
 namespace spright {
 
-#if !defined(NONSTD_SPAN_HPP_INCLUDED)
-using SpriteSpan = std::span<Sprite>;
-#else
-using SpriteSpan = nonstd::span<Sprite>;
-#endif
-
 struct PackedTexture {
   std::filesystem::path filename;
   int width{ };
@@ -23,16 +11,22 @@ struct PackedTexture {
   SpriteSpan sprites;
   Alpha alpha{ };
   RGBA colorkey{ };
+  int bleed_radius{ };
 };
 
 std::pair<int, int> get_texture_max_size(const Texture& texture);
 Size get_sprite_size(const Sprite& sprite);
 Size get_sprite_indent(const Sprite& sprite);
+void update_mask_spans(Sprite& sprite);
 
+std::vector<SpriteSpan> sort_sprites_by_texture(std::vector<Sprite>& sprites);
+void pack_texture_sprites(SpriteSpan sprites, std::vector<PackedTexture>& packed_textures);
 std::vector<PackedTexture> pack_sprites(std::vector<Sprite>& sprites);
 
 void pack_binpack(const Texture& texture, SpriteSpan sprites,
   bool fast, std::vector<PackedTexture>& packed_textures);
+void pack_best(const Texture& texture, SpriteSpan sprites,
+  bool fast, std::vector<PackedTexture>& packed_textures);
 void pack_compact(const Texture& texture, SpriteSpan sprites,
   std::vector<PackedTexture>& packed_textures);
 void pack_single(const Texture& texture, SpriteSpan sprites,
@@ -0,0 +1,350 @@
+
+#include "scanning.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# define SCAN_X86
+# include <immintrin.h>
+# define TARGET(isa) __attribute__((target(isa)))
+#elif defined(_M_X64)
+# define SCAN_X86
+# define SCAN_SSE2_ONLY
+# include <immintrin.h>
+# define TARGET(isa)
+#endif
+
+namespace spright {
+
+namespace {
+  // RGBA::gray() = (r * 77 + g * 151 + b * 28) >> 8
+  const auto weight_r = 77;
+  const auto weight_g = 151;
+  const auto weight_b = 28;
+
+  int find_alpha_at_least_scalar(const RGBA* pixels, int count, int threshold) {
+    for (auto i = 0; i < count; ++i)
+      if (pixels[i].a >= threshold)
+        return i;
+    return count;
+  }
+
+  int find_alpha_below_scalar(const RGBA* pixels, int count, int threshold) {
+    for (auto i = 0; i < count; ++i)
+      if (pixels[i].a < threshold)
+        return i;
+    return count;
+  }
+
+  int find_gray_at_least_scalar(const RGBA* pixels, int count, int threshold) {
+    for (auto i = 0; i < count; ++i)
+      if (pixels[i].gray() >= threshold)
+        return i;
+    return count;
+  }
+
+  int find_gray_below_scalar(const RGBA* pixels, int count, int threshold) {
+    for (auto i = 0; i < count; ++i)
+      if (pixels[i].gray() < threshold)
+        return i;
+    return count;
+  }
+
+  int find_last_alpha_at_least_scalar(const RGBA* pixels, int count, int threshold) {
+    for (auto i = count - 1; i >= 0; --i)
+      if (pixels[i].a >= threshold)
+        return i;
+    return -1;
+  }
+
+  int find_last_gray_at_least_scalar(const RGBA* pixels, int count, int threshold) {
+    for (auto i = count - 1; i >= 0; --i)
+      if (pixels[i].gray() >= threshold)
+        return i;
+    return -1;
+  }
+
+  const auto scalar_kernels = ScanKernels{
+    "scalar",
+    find_alpha_at_least_scalar,
+    find_alpha_below_scalar,
+    find_gray_at_least_scalar,
+    find_gray_below_scalar,
+    find_last_alpha_at_least_scalar,
+    find_last_gray_at_least_scalar,
+  };
+
+#if defined(SCAN_X86)
+  // the vectorized kernels test blocks of pixels at once, then the scalar
+  // kernel locates the first match within the block or handles the rest.
+  // the backward kernels start with the last block and end with the rest
+
+  TARGET("sse2") __m128i alpha_sse2(__m128i pixels) {
+    return _mm_srli_epi32(pixels, 24);
+  }
+
+  TARGET("sse2") __m128i gray_sse2(__m128i pixels) {
+    const auto mask = _mm_set1_epi32(0x00FF00FF);
+    const auto rb = _mm_madd_epi16(_mm_and_si128(pixels, mask),
+      _mm_set1_epi32((weight_b << 16) | weight_r));
+    const auto g = _mm_madd_epi16(_mm_and_si128(_mm_srli_epi32(pixels, 8), mask),
+      _mm_set1_epi32(weight_g));
+    return _mm_srli_epi32(_mm_add_epi32(rb, g), 8);
+  }
+
+#define SCAN_SSE2(NAME, VALUE, MATCH, LIMIT, SCALAR) \
+  TARGET("sse2") int NAME(const RGBA* pixels, int count, int threshold) { \
+    const auto limit = _mm_set1_epi32(LIMIT); \
+    const auto p = reinterpret_cast<const __m128i*>(pixels); \
+    auto i = 0; \
+    for (; i + 16 <= count; i += 16) { \
+      const auto m0 = MATCH(VALUE(_mm_loadu_si128(p + i / 4 + 0)), limit); \
+      const auto m1 = MATCH(VALUE(_mm_loadu_si128(p + i / 4 + 1)), limit); \
+      const auto m2 = MATCH(VALUE(_mm_loadu_si128(p + i / 4 + 2)), limit); \
+      const auto m3 = MATCH(VALUE(_mm_loadu_si128(p + i / 4 + 3)), limit); \
+      if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(m0, m1), _mm_or_si128(m2, m3)))) \
+        return i + SCALAR(pixels + i, 16, threshold); \
+    } \
+    for (; i + 4 <= count; i += 4) \
+      if (_mm_movemask_epi8(MATCH(VALUE(_mm_loadu_si128(p + i / 4)), limit))) \
+        return i + SCALAR(pixels + i, 4, threshold); \
+    return i + SCALAR(pixels + i, count - i, threshold); \
+  }
+
+  SCAN_SSE2(find_alpha_at_least_sse2, alpha_sse2, _mm_cmpgt_epi32,
+    threshold - 1, find_alpha_at_least_scalar)
+  SCAN_SSE2(find_alpha_below_sse2, alpha_sse2, _mm_cmplt_epi32,
+    threshold, find_alpha_below_scalar)
+  SCAN_SSE2(find_gray_at_least_sse2, gray_sse2, _mm_cmpgt_epi32,
+    threshold - 1, find_gray_at_least_scalar)
+  SCAN_SSE2(find_gray_below_sse2, gray_sse2, _mm_cmplt_epi32,
+    threshold, find_gray_below_scalar)
+#undef SCAN_SSE2
+
+#define SCAN_LAST_SSE2(NAME, VALUE, MATCH, LIMIT, SCALAR) \
+  TARGET("sse2") int NAME(const RGBA* pixels, int count, int threshold) { \
+    const auto limit = _mm_set1_epi32(LIMIT); \
+    auto i = count; \
+    for (; i >= 16; i -= 16) { \
+      const auto p = reinterpret_cast<const __m128i*>(pixels + i - 16); \
+      const auto m0 = MATCH(VALUE(_mm_loadu_si128(p + 0)), limit); \
+      const auto m1 = MATCH(VALUE(_mm_loadu_si128(p + 1)), limit); \
+      const auto m2 = MATCH(VALUE(_mm_loadu_si128(p + 2)), limit); \
+      const auto m3 = MATCH(VALUE(_mm_loadu_si128(p + 3)), limit); \
+      if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(m0, m1), _mm_or_si128(m2, m3)))) \
+        return i - 16 + SCALAR(pixels + i - 16, 16, threshold); \
+    } \
+    for (; i >= 4; i -= 4) \
+      if (_mm_movemask_epi8(MATCH(VALUE(_mm_loadu_si128( \
+            reinterpret_cast<const __m128i*>(pixels + i - 4))), limit))) \
+        return i - 4 + SCALAR(pixels + i - 4, 4, threshold); \
+    return SCALAR(pixels, i, threshold); \
+  }
+
+  SCAN_LAST_SSE2(find_last_alpha_at_least_sse2, alpha_sse2, _mm_cmpgt_epi32,
+    threshold - 1, find_last_alpha_at_least_scalar)
+  SCAN_LAST_SSE2(find_last_gray_at_least_sse2, gray_sse2, _mm_cmpgt_epi32,
+    threshold - 1, find_last_gray_at_least_scalar)
+#undef SCAN_LAST_SSE2
+
+  const auto sse2_kernels = ScanKernels{
+    "sse2",
+    find_alpha_at_least_sse2,
+    find_alpha_below_sse2,
+    find_gray_at_least_sse2,
+    find_gray_below_sse2,
+    find_last_alpha_at_least_sse2,
+    find_last_gray_at_least_sse2,
+  };
+
+#if !defined(SCAN_SSE2_ONLY)
+  TARGET("avx2") __m256i alpha_avx2(__m256i pixels) {
+    return _mm256_srli_epi32(pixels, 24);
+  }
+
+  TARGET("avx2") __m256i gray_avx2(__m256i pixels) {
+    const auto mask = _mm256_set1_epi32(0x00FF00FF);
+    const auto rb = _mm256_madd_epi16(_mm256_and_si256(pixels, mask),
+      _mm256_set1_epi32((weight_b << 16) | weight_r));
+    const auto g = _mm256_madd_epi16(_mm256_and_si256(_mm256_srli_epi32(pixels, 8), mask),
+      _mm256_set1_epi32(weight_g));
+    return _mm256_srli_epi32(_mm256_add_epi32(rb, g), 8);
+  }
+
+  TARGET("avx2") __m256i cmplt_epi32_avx2(__m256i a, __m256i b) {
+    return _mm256_cmpgt_epi32(b, a);
+  }
+
+#define SCAN_AVX2(NAME, VALUE, MATCH, LIMIT, SCALAR) \
+  TARGET("avx2") int NAME(const RGBA* pixels, int count, int threshold) { \
+    const auto limit = _mm256_set1_epi32(LIMIT); \
+    const auto p = reinterpret_cast<const __m256i*>(pixels); \
+    auto i = 0; \
+    for (; i + 32 <= count; i += 32) { \
+      const auto m0 = MATCH(VALUE(_mm256_loadu_si256(p + i / 8 + 0)), limit); \
+      const auto m1 = MATCH(VALUE(_mm256_loadu_si256(p + i / 8 + 1)), limit); \
+      const auto m2 = MATCH(VALUE(_mm256_loadu_si256(p + i / 8 + 2)), limit); \
+      const auto m3 = MATCH(VALUE(_mm256_loadu_si256(p + i / 8 + 3)), limit); \
+      if (_mm256_movemask_epi8(_mm256_or_si256( \
+            _mm256_or_si256(m0, m1), _mm256_or_si256(m2, m3)))) \
+        return i + SCALAR(pixels + i, 32, threshold); \
+    } \
+    for (; i + 8 <= count; i += 8) \
+      if (_mm256_movemask_epi8(MATCH(VALUE(_mm256_loadu_si256(p + i / 8)), limit))) \
+        return i + SCALAR(pixels + i, 8, threshold); \
+    return i + SCALAR(pixels + i, count - i, threshold); \
+  }
+
+  SCAN_AVX2(find_alpha_at_least_avx2, alpha_avx2, _mm256_cmpgt_epi32,
+    threshold - 1, find_alpha_at_least_scalar)
+  SCAN_AVX2(find_alpha_below_avx2, alpha_avx2, cmplt_epi32_avx2,
+    threshold, find_alpha_below_scalar)
+  SCAN_AVX2(find_gray_at_least_avx2, gray_avx2, _mm256_cmpgt_epi32,
+    threshold - 1, find_gray_at_least_scalar)
+  SCAN_AVX2(find_gray_below_avx2, gray_avx2, cmplt_epi32_avx2,
+    threshold, find_gray_below_scalar)
+#undef SCAN_AVX2
+
+#define SCAN_LAST_AVX2(NAME, VALUE, MATCH, LIMIT, SCALAR) \
+  TARGET("avx2") int NAME(const RGBA* pixels, int count, int threshold) { \
+    const auto limit = _mm256_set1_epi32(LIMIT); \
+    auto i = count; \
+    for (; i >= 32; i -= 32) { \
+      const auto p = reinterpret_cast<const __m256i*>(pixels + i - 32); \
+      const auto m0 = MATCH(VALUE(_mm256_loadu_si256(p + 0)), limit); \
+      const auto m1 = MATCH(VALUE(_mm256_loadu_si256(p + 1)), limit); \
+      const auto m2 = MATCH(VALUE(_mm256_loadu_si256(p + 2)), limit); \
+      const auto m3 = MATCH(VALUE(_mm256_loadu_si256(p + 3)), limit); \
+      if (_mm256_movemask_epi8(_mm256_or_si256( \
+            _mm256_or_si256(m0, m1), _mm256_or_si256(m2, m3)))) \
+        return i - 32 + SCALAR(pixels + i - 32, 32, threshold); \
+    } \
+    for (; i >= 8; i -= 8) \
+      if (_mm256_movemask_epi8(MATCH(VALUE(_mm256_loadu_si256( \
+            reinterpret_cast<const __m256i*>(pixels + i - 8))), limit))) \
+        return i - 8 + SCALAR(pixels + i - 8, 8, threshold); \
+    return SCALAR(pixels, i, threshold); \
+  }
+
+  SCAN_LAST_AVX2(find_last_alpha_at_least_avx2, alpha_avx2, _mm256_cmpgt_epi32,
+    threshold - 1, find_last_alpha_at_least_scalar)
+  SCAN_LAST_AVX2(find_last_gray_at_least_avx2, gray_avx2, _mm256_cmpgt_epi32,
+    threshold - 1, find_last_gray_at_least_scalar)
+#undef SCAN_LAST_AVX2
+
+  const auto avx2_kernels = ScanKernels{
+    "avx2",
+    find_alpha_at_least_avx2,
+    find_alpha_below_avx2,
+    find_gray_at_least_avx2,
+    find_gray_below_avx2,
+    find_last_alpha_at_least_avx2,
+    find_last_gray_at_least_avx2,
+  };
+
+  // GCC 12 warns about the undefined source of the unmasked shift
+  TARGET("avx512f,avx512bw") __m512i srli_epi32_avx512(__m512i pixels, unsigned int count) {
+    return _mm512_maskz_srli_epi32(static_cast<__mmask16>(-1), pixels, count);
+  }
+
+  TARGET("avx512f,avx512bw") __m512i alpha_avx512(__m512i pixels) {
+    return srli_epi32_avx512(pixels, 24);
+  }
+
+  TARGET("avx512f,avx512bw") __m512i gray_avx512(__m512i pixels) {
+    const auto mask = _mm512_set1_epi32(0x00FF00FF);
+    const auto rb = _mm512_madd_epi16(_mm512_and_si512(pixels, mask),
+      _mm512_set1_epi32((weight_b << 16) | weight_r));
+    const auto g = _mm512_madd_epi16(_mm512_and_si512(srli_epi32_avx512(pixels, 8), mask),
+      _mm512_set1_epi32(weight_g));
+    return srli_epi32_avx512(_mm512_add_epi32(rb, g), 8);
+  }
+
+#define SCAN_AVX512(NAME, VALUE, MATCH, LIMIT, SCALAR) \
+  TARGET("avx512f,avx512bw") int NAME(const RGBA* pixels, int count, int threshold) { \
+    const auto limit = _mm512_set1_epi32(LIMIT); \
+    const auto p = reinterpret_cast<const __m512i*>(pixels); \
+    auto i = 0; \
+    for (; i + 64 <= count; i += 64) { \
+      const auto m0 = MATCH(VALUE(_mm512_loadu_si512(p + i / 16 + 0)), limit); \
+      const auto m1 = MATCH(VALUE(_mm512_loadu_si512(p + i / 16 + 1)), limit); \
+      const auto m2 = MATCH(VALUE(_mm512_loadu_si512(p + i / 16 + 2)), limit); \
+      const auto m3 = MATCH(VALUE(_mm512_loadu_si512(p + i / 16 + 3)), limit); \
+      if (m0 | m1 | m2 | m3) \
+        return i + SCALAR(pixels + i, 64, threshold); \
+    } \
+    for (; i + 16 <= count; i += 16) \
+      if (MATCH(VALUE(_mm512_loadu_si512(p + i / 16)), limit)) \
+        return i + SCALAR(pixels + i, 16, threshold); \
+    return i + SCALAR(pixels + i, count - i, threshold); \
+  }
+
+  SCAN_AVX512(find_alpha_at_least_avx512, alpha_avx512, _mm512_cmpgt_epi32_mask,
+    threshold - 1, find_alpha_at_least_scalar)
+  SCAN_AVX512(find_alpha_below_avx512, alpha_avx512, _mm512_cmplt_epi32_mask,
+    threshold, find_alpha_below_scalar)
+  SCAN_AVX512(find_gray_at_least_avx512, gray_avx512, _mm512_cmpgt_epi32_mask,
+    threshold - 1, find_gray_at_least_scalar)
+  SCAN_AVX512(find_gray_below_avx512, gray_avx512, _mm512_cmplt_epi32_mask,
+    threshold, find_gray_below_scalar)
+#undef SCAN_AVX512
+
+#define SCAN_LAST_AVX512(NAME, VALUE, MATCH, LIMIT, SCALAR) \
+  TARGET("avx512f,avx512bw") int NAME(const RGBA* pixels, int count, int threshold) { \
+    const auto limit = _mm512_set1_epi32(LIMIT); \
+    auto i = count; \
+    for (; i >= 64; i -= 64) { \
+      const auto p = reinterpret_cast<const __m512i*>(pixels + i - 64); \
+      const auto m0 = MATCH(VALUE(_mm512_loadu_si512(p + 0)), limit); \
+      const auto m1 = MATCH(VALUE(_mm512_loadu_si512(p + 1)), limit); \
+      const auto m2 = MATCH(VALUE(_mm512_loadu_si512(p + 2)), limit); \
+      const auto m3 = MATCH(VALUE(_mm512_loadu_si512(p + 3)), limit); \
+      if (m0 | m1 | m2 | m3) \
+        return i - 64 + SCALAR(pixels + i - 64, 64, threshold); \
+    } \
+    for (; i >= 16; i -= 16) \
+      if (MATCH(VALUE(_mm512_loadu_si512( \
+            reinterpret_cast<const __m512i*>(pixels + i - 16))), limit)) \
+        return i - 16 + SCALAR(pixels + i - 16, 16, threshold); \
+    return SCALAR(pixels, i, threshold); \
+  }
+
+  SCAN_LAST_AVX512(find_last_alpha_at_least_avx512, alpha_avx512, _mm512_cmpgt_epi32_mask,
+    threshold - 1, find_last_alpha_at_least_scalar)
+  SCAN_LAST_AVX512(find_last_gray_at_least_avx512, gray_avx512, _mm512_cmpgt_epi32_mask,
+    threshold - 1, find_last_gray_at_least_scalar)
+#undef SCAN_LAST_AVX512
+
+  const auto avx512_kernels = ScanKernels{
+    "avx512",
+    find_alpha_at_least_avx512,
+    find_alpha_below_avx512,
+    find_gray_at_least_avx512,
+    find_gray_below_avx512,
+    find_last_alpha_at_least_avx512,
+    find_last_gray_at_least_avx512,
+  };
+#endif // !SCAN_SSE2_ONLY
+#endif // SCAN_X86
+} // namespace
+
+std::vector<const ScanKernels*> get_supported_scan_kernels() {
+  auto kernels = std::vector<const ScanKernels*>();
+  kernels.push_back(&scalar_kernels);
+#if defined(SCAN_X86)
+  kernels.push_back(&sse2_kernels);
+# if !defined(SCAN_SSE2_ONLY)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    kernels.push_back(&avx2_kernels);
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+    kernels.push_back(&avx512_kernels);
+# endif
+#endif
+  return kernels;
+}
+
+const ScanKernels& scan_kernels() {
+  static const auto& s_kernels = *get_supported_scan_kernels().back();
+  return s_kernels;
+}
+
+} // namespace
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "common.h"
+#include <vector>
+
+namespace spright {
+
+// kernels searching a row of pixels, which return the index of the first
+// pixel matching the condition or count when there is none
+using FindPixel = int(*)(const RGBA* pixels, int count, int threshold);
+
+// kernels searching a row of pixels backwards, which return the index of
+// the last pixel matching the condition or -1 when there is none
+using FindLastPixel = int(*)(const RGBA* pixels, int count, int threshold);
+
+struct ScanKernels {
+  const char* name;
+  FindPixel find_alpha_at_least;
+  FindPixel find_alpha_below;
+  FindPixel find_gray_at_least;
+  FindPixel find_gray_below;
+  FindLastPixel find_last_alpha_at_least;
+  FindLastPixel find_last_gray_at_least;
+};
+
+// the fastest kernels supported by the CPU, selected on first use
+const ScanKernels& scan_kernels();
+std::vector<const ScanKernels*> get_supported_scan_kernels();
+
+} // namespace
@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <sstream>
 #include <iterator>
+#include <charconv>
 
 namespace spright {
 
@@ -63,12 +64,38 @@ bool interpret_commandline(Settings& settings, int argc, const char* argv[]) {
         return false;
       settings.output_path = std::filesystem::u8path(unquote(argv[i]));
     }
+    else if (argument == "-c" || argument == "--cache") {
+      if (++i >= argc)
+        return false;
+      settings.cache_path = std::filesystem::u8path(unquote(argv[i]));
+    }
+    else if (argument == "-s" || argument == "--stats") {
+      if (++i >= argc)
+        return false;
+      settings.stats_file = std::filesystem::u8path(unquote(argv[i]));
+    }
+    else if (argument == "-r" || argument == "--trace") {
+      if (++i >= argc)
+        return false;
+      settings.trace_file = std::filesystem::u8path(unquote(argv[i]));
+    }
     else if (argument == "-a" || argument == "--autocomplete") {
       settings.autocomplete = true;
     }
     else if (argument == "-d" || argument == "--debug") {
       settings.debug = true;
     }
+    else if (argument == "-w" || argument == "--watch") {
+      settings.watch = true;
+    }
+    else if (argument == "-j" || argument == "--jobs") {
+      if (++i >= argc)
+        return false;
+      const auto value = std::string_view(argv[i]);
+      const auto [p, ec] = std::from_chars(value.data(), value.data() + value.size(), settings.jobs);
+      if (ec != std::errc() || p != value.data() + value.size() || settings.jobs < 0)
+        return false;
+    }
     else {
       return false;
     }
@@ -107,8 +134,13 @@ void print_help_message(const char* argv0) {
     "  -o, --output <file>    output description file (default: %s).\n"
     "  -t, --template <file>  template for output description.\n"
     "  -p, --path <path>      path to prepend to all output files.\n"
+    "  -c, --cache <path>     cache decoded inputs and results to skip unchanged work.\n"
+    "  -s, --stats <file>     write build statistics to file.\n"
+    "  -r, --trace <file>     write Chrome trace events to file.\n"
     "  -a, --autocomplete     autocomplete input definition.\n"
     "  -d, --debug            draw sprite boundaries and pivot points on output.\n"
+    "  -w, --watch            rebuild when input files change.\n"
+    "  -j, --jobs <count>     number of parallel jobs (default: number of cores).\n"
     "  -h, --help             print this help.\n"
     "  -- <args>              interpret remaining arguments as a comma separated\n"
     "                         list of input definitions.\n"
@@ -13,8 +13,13 @@ struct Settings {
   std::filesystem::path output_path;
   std::filesystem::path output_file;
   std::filesystem::path template_file;
+  std::filesystem::path cache_path;
+  std::filesystem::path stats_file;
+  std::filesystem::path trace_file;
   bool autocomplete{ };
   bool debug{ };
+  bool watch{ };
+  int jobs{ };
 };
 
 bool interpret_commandline(Settings& settings, int argc, const char* argv[]);
@@ -0,0 +1,414 @@
+
+#include "stats.h"
+#include "ThreadPool.h"
+#include "nlohmann/json.hpp"
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <queue>
+
+#if !defined(_WIN32)
+# include <sys/resource.h>
+#endif
+
+namespace spright {
+
+namespace {
+  using Clock = std::chrono::steady_clock;
+  using Duration = std::chrono::nanoseconds;
+  const auto stage_count = static_cast<size_t>(Stage::count);
+  const auto slowest_sprite_count = size_t{ 10 };
+
+  struct TrimmedSprite {
+    Duration time;
+    std::string id;
+    std::string source;
+    Rect source_rect;
+  };
+
+  struct SlowerTrim {
+    bool operator()(const TrimmedSprite& a, const TrimmedSprite& b) const {
+      return a.time > b.time;
+    }
+  };
+
+  // the slowest trimmed sprites are collected per thread, with the
+  // fastest of them on top
+  struct ThreadStats {
+    std::priority_queue<TrimmedSprite,
+      std::vector<TrimmedSprite>, SlowerTrim> slowest_trims;
+  };
+
+  struct Stats {
+    Clock::time_point start;
+    std::array<std::atomic<int64_t>, stage_count> times;
+    // allocations outside of any stage are counted in the last slot
+    std::array<std::atomic<uint64_t>, stage_count + 1> allocations;
+    std::atomic<uint64_t> bytes_read;
+    std::atomic<uint64_t> pixels_scanned;
+    std::mutex mutex;
+    std::map<std::string, std::array<Duration, stage_count>> named_times;
+    std::vector<std::unique_ptr<ThreadStats>> threads;
+  };
+
+  struct TraceEvent {
+    Stage stage;
+    std::string name;
+    Clock::time_point begin;
+    Clock::duration duration;
+  };
+
+  // events are collected per thread, to not serialize the workers
+  struct ThreadTrace {
+    int thread_id;
+    std::vector<TraceEvent> events;
+  };
+
+  struct Trace {
+    Clock::time_point start;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadTrace>> threads;
+  };
+
+  bool s_stats_enabled;
+  bool s_trace_enabled;
+  thread_local StageScope* t_current_scope;
+  thread_local ThreadTrace* t_thread_trace;
+  thread_local ThreadStats* t_thread_stats;
+
+  Stats& stats() {
+    static Stats s_stats;
+    return s_stats;
+  }
+
+  Trace& trace() {
+    static Trace s_trace;
+    return s_trace;
+  }
+
+  ThreadTrace& thread_trace() {
+    if (!t_thread_trace) {
+      auto& t = trace();
+      auto lock = std::lock_guard(t.mutex);
+      const auto thread_id = static_cast<int>(t.threads.size()) + 1;
+      t_thread_trace = t.threads.emplace_back(
+        std::make_unique<ThreadTrace>(ThreadTrace{ thread_id, { } })).get();
+    }
+    return *t_thread_trace;
+  }
+
+  ThreadStats& thread_stats() {
+    if (!t_thread_stats) {
+      auto& s = stats();
+      auto lock = std::lock_guard(s.mutex);
+      t_thread_stats = s.threads.emplace_back(
+        std::make_unique<ThreadStats>()).get();
+    }
+    return *t_thread_stats;
+  }
+
+  // times of these stages are also reported per output texture
+  bool is_texture_stage(Stage stage) {
+    return (stage == Stage::deduplicate ||
+            stage == Stage::pack ||
+            stage == Stage::compose ||
+            stage == Stage::alpha ||
+            stage == Stage::encode);
+  }
+
+  const char* get_stage_name(Stage stage) {
+    switch (stage) {
+      case Stage::parse: return "parse";
+      case Stage::decode: return "decode";
+      case Stage::trim: return "trim";
+      case Stage::deduplicate: return "deduplicate";
+      case Stage::pack: return "pack";
+      case Stage::compose: return "compose";
+      case Stage::alpha: return "alpha";
+      case Stage::encode: return "encode";
+      case Stage::count: break;
+    }
+    return "";
+  }
+
+  int64_t get_peak_rss() {
+#if !defined(_WIN32)
+    auto usage = rusage{ };
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+      return 0;
+# if defined(__APPLE__)
+    return static_cast<int64_t>(usage.ru_maxrss);
+# else
+    return static_cast<int64_t>(usage.ru_maxrss) * 1024;
+# endif
+#else
+    return 0;
+#endif
+  }
+
+  double to_milliseconds(Duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+  }
+
+  uintmax_t get_file_size(const std::filesystem::path& filename) {
+    auto error = std::error_code{ };
+    const auto size = std::filesystem::file_size(filename, error);
+    return (error ? 0 : size);
+  }
+} // namespace
+
+StageScope::StageScope(Stage stage, std::string_view name)
+  : m_stage(stage),
+    m_enabled(s_stats_enabled || s_trace_enabled) {
+  if (!m_enabled)
+    return;
+
+  m_name = name;
+  const auto now = Clock::now();
+  m_parent = std::exchange(t_current_scope, this);
+  if (m_parent)
+    m_parent->m_elapsed += now - m_parent->m_start;
+  m_begin = now;
+  m_start = now;
+}
+
+StageScope::~StageScope() {
+  if (!m_enabled)
+    return;
+
+  const auto now = Clock::now();
+  m_elapsed += now - m_start;
+  t_current_scope = m_parent;
+  if (m_parent)
+    m_parent->m_start = now;
+
+  if (s_stats_enabled) {
+    auto& s = stats();
+    const auto index = static_cast<size_t>(m_stage);
+    const auto elapsed = std::chrono::duration_cast<Duration>(m_elapsed);
+    s.times[index].fetch_add(elapsed.count(), std::memory_order_relaxed);
+
+    if (!m_name.empty() && is_texture_stage(m_stage)) {
+      auto lock = std::lock_guard(s.mutex);
+      s.named_times[m_name][index] += elapsed;
+    }
+  }
+
+  if (s_trace_enabled)
+    thread_trace().events.push_back({ m_stage, std::move(m_name),
+      m_begin, now - m_begin });
+}
+
+std::chrono::nanoseconds StageScope::elapsed() const {
+  auto elapsed = m_elapsed;
+  if (t_current_scope == this)
+    elapsed += Clock::now() - m_start;
+  return std::chrono::duration_cast<Duration>(elapsed);
+}
+
+void enable_stats() {
+  reset_stats();
+  s_stats_enabled = true;
+}
+
+bool stats_enabled() {
+  return s_stats_enabled;
+}
+
+void count_allocation() {
+  if (!s_stats_enabled)
+    return;
+  const auto scope = t_current_scope;
+  const auto index = (scope ? static_cast<size_t>(scope->stage()) : stage_count);
+  stats().allocations[index].fetch_add(1, std::memory_order_relaxed);
+}
+
+void reset_stats() {
+  auto& s = stats();
+  auto lock = std::lock_guard(s.mutex);
+  s.start = Clock::now();
+  for (auto& time : s.times)
+    time = 0;
+  for (auto& allocations : s.allocations)
+    allocations = 0;
+  s.bytes_read = 0;
+  s.pixels_scanned = 0;
+  s.named_times.clear();
+  for (auto& thread : s.threads)
+    thread->slowest_trims = { };
+}
+
+void add_bytes_read(uintmax_t bytes) {
+  stats().bytes_read.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void add_trimmed_sprite(const Sprite& sprite, std::chrono::nanoseconds time) {
+  auto& s = stats();
+  if (sprite.trim != Trim::none)
+    s.pixels_scanned.fetch_add(static_cast<uint64_t>(
+      sprite.source_rect.w * sprite.source_rect.h), std::memory_order_relaxed);
+
+  auto& slowest = thread_stats().slowest_trims;
+  if (slowest.size() == slowest_sprite_count) {
+    if (time <= slowest.top().time)
+      return;
+    slowest.pop();
+  }
+  slowest.push({ time, sprite.id,
+    path_to_utf8(sprite.source->path() / sprite.source->filename()),
+    sprite.source_rect });
+}
+
+void write_stats(const Settings& settings, const std::vector<Sprite>& sprites,
+    const std::vector<PackedTexture>& textures) {
+  auto& s = stats();
+  auto lock = std::lock_guard(s.mutex);
+
+  auto json = nlohmann::json::object();
+  json["jobs"] = thread_pool().thread_count();
+  json["totalMs"] = to_milliseconds(Clock::now() - s.start);
+  json["sprites"] = sprites.size();
+
+  auto& json_stages = json["stages"];
+  for (auto i = size_t{ }; i < stage_count; ++i) {
+    auto& json_stage = json_stages[get_stage_name(static_cast<Stage>(i))];
+    json_stage["ms"] = to_milliseconds(Duration(s.times[i].load()));
+#if defined(SPRIGHT_COUNT_ALLOCATIONS)
+    json_stage["allocations"] = s.allocations[i].load();
+#endif
+  }
+#if defined(SPRIGHT_COUNT_ALLOCATIONS)
+  json["otherAllocations"] = s.allocations[stage_count].load();
+#endif
+  // stages run concurrently, so only the process's peak is meaningful
+  json["peakRss"] = get_peak_rss();
+
+  auto bytes_written = uintmax_t{ };
+  auto& json_textures = json["textures"];
+  json_textures = nlohmann::json::array();
+  for (const auto& texture : textures) {
+    const auto filename = path_to_utf8(texture.filename);
+    const auto bytes = get_file_size(settings.output_path / texture.filename);
+    bytes_written += bytes;
+
+    auto sprite_area = int64_t{ };
+    for (const auto& sprite : texture.sprites)
+      sprite_area += int64_t{ sprite.trimmed_rect.w } * sprite.trimmed_rect.h;
+    const auto texture_area = int64_t{ texture.width } * texture.height;
+
+    // packing is measured per output texture definition
+    const auto get_time = [&](const std::string& name, Stage stage) {
+      const auto it = s.named_times.find(name);
+      return (it == s.named_times.end() ? 0.0 :
+        to_milliseconds(it->second[static_cast<size_t>(stage)]));
+    };
+    const auto definition = (texture.sprites.empty() ? std::string() :
+      texture.sprites.front().texture->filename.filename());
+
+    auto& json_texture = json_textures.emplace_back();
+    json_texture["filename"] = filename;
+    json_texture["width"] = texture.width;
+    json_texture["height"] = texture.height;
+    json_texture["sprites"] = texture.sprites.size();
+    json_texture["occupancy"] = (texture_area ?
+      static_cast<double>(sprite_area) / static_cast<double>(texture_area) : 0.0);
+    json_texture["packMs"] = get_time(definition, Stage::pack) +
+      get_time(definition, Stage::deduplicate);
+    json_texture["composeMs"] = get_time(filename, Stage::compose);
+    json_texture["alphaMs"] = get_time(filename, Stage::alpha);
+    json_texture["encodeMs"] = get_time(filename, Stage::encode);
+    json_texture["bytes"] = bytes;
+  }
+  if (settings.output_file != "stdout")
+    bytes_written += get_file_size(settings.output_path / settings.output_file);
+
+  json["bytesRead"] = s.bytes_read.load();
+  json["bytesWritten"] = bytes_written;
+  json["pixelsScanned"] = s.pixels_scanned.load();
+
+  auto trimmed = std::vector<TrimmedSprite>();
+  for (const auto& thread : s.threads)
+    for (auto slowest = thread->slowest_trims; !slowest.empty(); slowest.pop())
+      trimmed.push_back(slowest.top());
+  const auto slowest = std::min(trimmed.size(), slowest_sprite_count);
+  std::partial_sort(trimmed.begin(), trimmed.begin() + static_cast<ptrdiff_t>(slowest),
+    trimmed.end(), SlowerTrim());
+  auto& json_slowest = json["slowestTrims"];
+  json_slowest = nlohmann::json::array();
+  for (auto i = size_t{ }; i < slowest; ++i) {
+    const auto& sprite = trimmed[i];
+    auto& json_sprite = json_slowest.emplace_back();
+    json_sprite["id"] = sprite.id;
+    json_sprite["source"] = sprite.source;
+    json_sprite["rect"] = { sprite.source_rect.x, sprite.source_rect.y,
+                            sprite.source_rect.w, sprite.source_rect.h };
+    json_sprite["ms"] = to_milliseconds(sprite.time);
+  }
+
+  auto file = std::ofstream(settings.stats_file, std::ios::out | std::ios::binary);
+  if (!file.good())
+    throw std::runtime_error("writing file '" +
+      path_to_utf8(settings.stats_file) + "' failed");
+  file << json.dump(2);
+}
+
+void enable_trace() {
+  reset_trace();
+  s_trace_enabled = true;
+}
+
+bool trace_enabled() {
+  return s_trace_enabled;
+}
+
+void reset_trace() {
+  auto& t = trace();
+  auto lock = std::lock_guard(t.mutex);
+  t.start = Clock::now();
+  for (auto& thread : t.threads)
+    thread->events.clear();
+}
+
+void write_trace(const Settings& settings) {
+  auto& t = trace();
+  auto lock = std::lock_guard(t.mutex);
+  const auto to_microseconds = [](Clock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+  };
+
+  // https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+  auto json_events = nlohmann::json::array();
+  for (const auto& thread : t.threads) {
+    auto& json_thread = json_events.emplace_back();
+    json_thread["name"] = "thread_name";
+    json_thread["ph"] = "M";
+    json_thread["pid"] = 1;
+    json_thread["tid"] = thread->thread_id;
+    json_thread["args"]["name"] = "thread " + std::to_string(thread->thread_id);
+
+    for (const auto& event : thread->events) {
+      auto& json_event = json_events.emplace_back();
+      json_event["name"] = get_stage_name(event.stage);
+      json_event["cat"] = "spright";
+      json_event["ph"] = "X";
+      json_event["ts"] = to_microseconds(event.begin - t.start);
+      json_event["dur"] = to_microseconds(event.duration);
+      json_event["pid"] = 1;
+      json_event["tid"] = thread->thread_id;
+      if (!event.name.empty())
+        json_event["args"]["name"] = event.name;
+    }
+  }
+  auto json = nlohmann::json::object();
+  json["traceEvents"] = std::move(json_events);
+  json["displayTimeUnit"] = "ms";
+
+  auto file = std::ofstream(settings.trace_file, std::ios::out | std::ios::binary);
+  if (!file.good())
+    throw std::runtime_error("writing file '" +
+      path_to_utf8(settings.trace_file) + "' failed");
+  file << json.dump();
+}
+
+} // namespace
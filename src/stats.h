@@ -0,0 +1,62 @@
+#pragma once
+
+#include "packing.h"
+#include <chrono>
+#include <string>
+
+namespace spright {
+
+enum class Stage {
+  parse,
+  decode,
+  trim,
+  deduplicate,
+  pack,
+  compose,
+  alpha,
+  encode,
+  count
+};
+
+// measures the time and allocations of a stage on the current thread.
+// time spent in nested scopes is only accounted to the innermost one.
+// when a name is set, the time of stages which are reported per output
+// texture is also accounted to it.
+// when tracing, a trace event is recorded for each scope
+class StageScope {
+public:
+  explicit StageScope(Stage stage, std::string_view name = { });
+  StageScope(const StageScope&) = delete;
+  StageScope& operator=(const StageScope&) = delete;
+  ~StageScope();
+
+  Stage stage() const { return m_stage; }
+  std::chrono::nanoseconds elapsed() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  const Stage m_stage;
+  bool m_enabled{ };
+  std::string m_name;
+  StageScope* m_parent{ };
+  Clock::time_point m_begin;
+  Clock::time_point m_start;
+  Clock::duration m_elapsed{ };
+};
+
+void enable_stats();
+bool stats_enabled();
+void reset_stats();
+void add_bytes_read(uintmax_t bytes);
+void count_allocation();
+void add_trimmed_sprite(const Sprite& sprite, std::chrono::nanoseconds time);
+void write_stats(const Settings& settings, const std::vector<Sprite>& sprites,
+  const std::vector<PackedTexture>& textures);
+
+void enable_trace();
+bool trace_enabled();
+void reset_trace();
+void write_trace(const Settings& settings);
+
+} // namespace
@@ -1,164 +1,802 @@
 
 #include "trimming.h"
-#include "chipmunk/chipmunk.h"
-extern "C" {
-#include "chipmunk/cpPolyline.h"
-#include "chipmunk/cpMarch.h"
-}
+#include "ThreadPool.h"
+#include "scanning.h"
+#include "stats.h"
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <queue>
 
 namespace spright {
 
 namespace {
-  struct FreePolyline { void operator()(cpPolyline* line) { cpPolylineFree(line); }; };
-  using PolylinePtr = std::unique_ptr<cpPolyline, FreePolyline>;
-
-  PolylinePtr merge_polylines(const cpPolylineSet& polyline_set) {
-    // TODO: find closest segments
-    // rotate vertices of one to begin at segment and delete end
-    // insert into other polyline at segment
-#if 0
-    auto count = 0;
-    for (auto i = 0; i < polyline_set.count; ++i)
-      count += polyline_set.lines[i]->count;
-
-    auto merged = PolylinePtr(static_cast<cpPolyline*>(cpcalloc(1,
-      sizeof(cpPolyline) + static_cast<size_t>(count) * sizeof(cpVect))));
-    merged->capacity = count;
-    merged->count = count;
-
-    auto pos = merged->verts;
-    for (auto i = 0; i < polyline_set.count; ++i) {
-      auto line = polyline_set.lines[i];
-      std::copy(line->verts, line->verts + line->count, pos);
-      pos += line->count;
-    }
-#else
-    auto line = std::add_pointer_t<cpPolyline>{ };
-    for (auto i = 0; i < polyline_set.count; ++i)
-      if (!line || polyline_set.lines[i]->count > line->count)
-        line = polyline_set.lines[i];
-
-    auto merged = PolylinePtr(static_cast<cpPolyline*>(cpcalloc(1,
-      sizeof(cpPolyline) + static_cast<size_t>(line->count) * sizeof(cpVect))));
-    merged->capacity = line->count;
-    merged->count = line->count;
-
-    std::copy(line->verts, line->verts + line->count, merged->verts);
-#endif
-    return merged;
-  }
-
-  PolylinePtr get_polygon_outline(const MonoImage& image, int threshold) {
-    const auto sample = [](cpVect point, void *data) -> cpFloat {
-      const auto& image = *static_cast<const MonoImage*>(data);
-      const auto x = static_cast<int>(point.x - 0.5);
-      const auto y = static_cast<int>(point.y - 0.5);
-      if (x < 0 || x >= image.width() || y < 0 || y >= image.height())
-        return 0;
-      return image.value_at({ x, y });
+  struct Vector {
+    double x;
+    double y;
+  };
+  using Polygon = std::vector<Vector>;
+
+  bool operator<(const Vector& a, const Vector& b) {
+    return std::tie(a.x, a.y) < std::tie(b.x, b.y);
+  }
+  bool operator==(const Vector& a, const Vector& b) {
+    return (a.x == b.x && a.y == b.y);
+  }
+  Vector operator-(const Vector& a, const Vector& b) {
+    return { a.x - b.x, a.y - b.y };
+  }
+  double dot(const Vector& a, const Vector& b) {
+    return a.x * b.x + a.y * b.y;
+  }
+  double cross(const Vector& a, const Vector& b) {
+    return a.x * b.y - a.y * b.x;
+  }
+  double length(const Vector& v) {
+    return std::sqrt(dot(v, v));
+  }
+  Vector normalize(const Vector& v) {
+    // the smallest double avoids a division by zero
+    const auto f = 1.0 / (length(v) + std::numeric_limits<double>::min());
+    return { v.x * f, v.y * f };
+  }
+
+  // a used pixel covers [index + 0.5, index + 1.5], the first one also
+  // [0, 0.5], clamped to the size. this keeps the outlines of the former
+  // marching squares sampling
+  double pixel_begin(int index) {
+    return (index == 0 ? 0.0 : index + 0.5);
+  }
+  double pixel_end(int index, int size) {
+    return std::min(index + 1.5, static_cast<double>(size));
+  }
+
+  // returns the closed convex hull of the points, beginning at the
+  // leftmost top point and continuing along the top. collinear points
+  // are omitted
+  Polygon get_convex_hull(Polygon points) {
+    // monotone chain, the top chain from left to right, then the bottom back
+    std::sort(points.begin(), points.end());
+    points.erase(std::unique(points.begin(), points.end()), points.end());
+    auto hull = Polygon();
+    const auto add_vertex = [&](const Vector& point, size_t chain_begin) {
+      while (hull.size() >= chain_begin + 2 &&
+             cross(hull.back() - hull[hull.size() - 2],
+                   point - hull[hull.size() - 2]) <= 0)
+        hull.pop_back();
+      hull.push_back(point);
     };
+    for (const auto& point : points)
+      add_vertex(point, 0);
+    const auto top_end = hull.size() - 1;
+    for (auto it = std::next(points.rbegin()); it != points.rend(); ++it)
+      add_vertex(*it, top_end);
+    return hull;
+  }
+
+  // returns the closed convex hull of all used pixels,
+  // empty when no pixel is used
+  Polygon get_convex_outline(const ImageView& image, bool gray_levels, int threshold) {
+    const auto& kernels = scan_kernels();
+    const auto find_used = (gray_levels ?
+      kernels.find_gray_at_least : kernels.find_alpha_at_least);
+    const auto is_used = [&](const RGBA& rgba) {
+      return ((gray_levels ? rgba.gray() : rgba.a) >= threshold);
+    };
+
+    // only the corners of the leftmost and rightmost used pixel of each
+    // row can be on the hull
+    auto points = Polygon();
+    const auto w = image.width();
+    const auto h = image.height();
+    for (auto y = 0; y < h; ++y) {
+      const auto row = image.row(y);
+      const auto x0 = find_used(row, w, threshold);
+      if (x0 == w)
+        continue;
+      auto x1 = w - 1;
+      while (!is_used(row[x1]))
+        --x1;
+      const auto y0 = pixel_begin(y);
+      const auto y1 = pixel_end(y, h);
+      points.push_back({ pixel_begin(x0), y0 });
+      points.push_back({ pixel_begin(x0), y1 });
+      points.push_back({ pixel_end(x1, w), y0 });
+      points.push_back({ pixel_end(x1, w), y1 });
+    }
+    if (points.empty())
+      return { };
+    return get_convex_hull(std::move(points));
+  }
+
+  size_t next(size_t index, size_t count) {
+    return (index + 1) % count;
+  }
 
-    const auto outlines = cpPolylineSetNew();
-    cpMarchHard(
-      { -1, -1, static_cast<float>(image.width() + 1), static_cast<float>(image.height() + 1) },
-      static_cast<unsigned long>(image.width() + 3),
-      static_cast<unsigned long>(image.height() + 3),
-      static_cast<float>(threshold - 1),
-      reinterpret_cast<cpMarchSegmentFunc>(cpPolylineSetCollectSegment), outlines,
-      sample, const_cast<MonoImage*>(&image));
+  bool is_short(const Polygon& polygon, size_t count,
+      size_t begin, size_t end, double min) {
+    auto sum = 0.0;
+    for (auto i = begin; i != end; i = next(i, count)) {
+      sum += length(polygon[i] - polygon[next(i, count)]);
+      if (sum > min)
+        return false;
+    }
+    return true;
+  }
+
+  void douglas_peucker(const Polygon& polygon, size_t count,
+      size_t begin, size_t end, double min, double tolerance, Polygon& reduced) {
+    if ((end + count - begin) % count < 2)
+      return;
+
+    const auto& a = polygon[begin];
+    const auto& b = polygon[end];
+    if (dot(a - b, a - b) < min * min &&
+        is_short(polygon, count, begin, end, min))
+      return;
 
-    assert(outlines->count > 0);
-    const auto right = cpFloat(image.width());
-    const auto bottom = cpFloat(image.height());
-    for (auto i = 0; i < outlines->count; ++i) {
-      auto& line = *outlines->lines[i];
-      auto& verts = line.verts;
-      for (auto j = 0; j < line.count; ++j) {
-        verts[j].x = std::clamp(verts[j].x, cpFloat{ }, right);
-        verts[j].y = std::clamp(verts[j].y, cpFloat{ }, bottom);
+    const auto delta = b - a;
+    const auto n = normalize({ -delta.y, delta.x });
+    const auto d = dot(n, a);
+    auto max = 0.0;
+    auto max_index = begin;
+    for (auto i = next(begin, count); i != end; i = next(i, count)) {
+      const auto distance = std::fabs(dot(n, polygon[i]) - d);
+      if (distance > max) {
+        max = distance;
+        max_index = i;
       }
     }
+    if (max > tolerance) {
+      douglas_peucker(polygon, count, begin, max_index, min, tolerance, reduced);
+      reduced.push_back(polygon[max_index]);
+      douglas_peucker(polygon, count, max_index, end, min, tolerance, reduced);
+    }
+  }
 
-    auto outline = PolylinePtr(merge_polylines(*outlines));
-    cpPolylineSetFree(outlines, true);
-    return outline;
+  // reduces the vertices of a closed polygon, so it deviates at most
+  // tolerance from the original. it is split at the leftmost and
+  // rightmost vertex, which are kept
+  Polygon simplify_polygon(const Polygon& polygon, double tolerance) {
+    const auto count = polygon.size() - 1;
+    auto left = size_t{ };
+    auto right = size_t{ };
+    for (auto i = size_t{ 1 }; i < count; ++i) {
+      if (polygon[i] < polygon[left])
+        left = i;
+      else if (polygon[right] < polygon[i])
+        right = i;
+    }
+
+    const auto min = tolerance / 2;
+    auto reduced = Polygon();
+    reduced.push_back(polygon[left]);
+    douglas_peucker(polygon, count, left, right, min, tolerance, reduced);
+    reduced.push_back(polygon[right]);
+    douglas_peucker(polygon, count, right, left, min, tolerance, reduced);
+    reduced.push_back(polygon[left]);
+    return reduced;
   }
 
-  cpVect normal(const cpVect& v) {
-    if (auto f = v.x * v.x + v.y * v.y; f != 0.0f) {
-      f = 1.0f / std::sqrt(f);
+  Vector normal(const Vector& v) {
+    if (auto f = v.x * v.x + v.y * v.y; f != 0.0) {
+      f = 1.0 / std::sqrt(f);
       return { v.y * f, -v.x * f, };
     }
     return { 0, 0 };
   }
 
-  void expand_polygon(cpPolyline& polyline, float distance) {
+  void expand_polygon(Polygon& polygon, float distance) {
     if (distance == 0)
       return;
     distance /= 2;
 
-    auto normals = std::vector<cpVect>();
-    normals.reserve(static_cast<size_t>(polyline.count));
-    for (auto i = 0; i < polyline.count; ++i) {
-      const auto& p0 = polyline.verts[i];
-      const auto& p1 = polyline.verts[(i + 1) %  polyline.count];
-      normals.push_back(normal({ p1.x - p0.x, p1.y - p0.y }));
-    }
+    auto normals = std::vector<Vector>();
+    normals.reserve(polygon.size());
+    for (auto i = size_t{ }; i < polygon.size(); ++i)
+      normals.push_back(normal(polygon[next(i, polygon.size())] - polygon[i]));
     for (auto i = size_t{ }; i < normals.size(); ++i) {
       const auto& n0 = normals[i];
       const auto& n1 = normals[(i - 1 + normals.size()) % normals.size()];
-      polyline.verts[i].x += (n0.x + n1.x) * distance;
-      polyline.verts[i].y += (n0.y + n1.y) * distance;
+      polygon[i].x += (n0.x + n1.x) * distance;
+      polygon[i].y += (n0.y + n1.y) * distance;
+    }
+  }
+
+  std::vector<PointF> to_point_list(const Polygon& polygon) {
+    auto vertices = std::vector<PointF>();
+    vertices.reserve(polygon.size());
+    for (const auto& vertex : polygon)
+      vertices.push_back({
+        static_cast<float>(vertex.x),
+        static_cast<float>(vertex.y)
+      });
+    return vertices;
+  }
+
+  // extends the used pixels of the rows by distance in both directions
+  MonoMask dilate_rows(const MonoMask& mask, int distance) {
+    auto dilated = MonoMask(mask.width(), mask.height());
+    for (auto y = 0; y < mask.height(); ++y)
+      for (auto x = mask.find_set(y, 0); x < mask.width(); x = mask.find_set(y, x)) {
+        const auto end = mask.find_unset(y, x);
+        dilated.set_run(y, x - distance, end + distance);
+        x = end;
+      }
+    return dilated;
+  }
+
+  // extends the used pixels of the columns by distance in both directions
+  MonoMask dilate_columns(const MonoMask& mask, int distance) {
+    auto dilated = MonoMask(mask.width(), mask.height());
+    for (auto y = 0; y < mask.height(); ++y) {
+      const auto row = dilated.row(y);
+      const auto y1 = std::min(y + distance, mask.height() - 1);
+      for (auto sy = std::max(y - distance, 0); sy <= y1; ++sy) {
+        const auto source = mask.row(sy);
+        for (auto i = 0; i < mask.words_per_row(); ++i)
+          row[i] |= source[i];
+      }
     }
+    return dilated;
   }
 
-  PolylinePtr to_convex_polygon(const cpPolyline& polyline, float tolerance) {
-    return PolylinePtr(cpPolylineToConvexHull(
-      const_cast<cpPolyline*>(&polyline), tolerance));
+  // returns the first x at or right of begin, where the 2x2 block at (x, y)
+  // has only its diagonal pixels used, or the width minus one
+  int find_diagonal_gap(const MonoMask& mask, int y, int begin) {
+    using Word = MonoMask::Word;
+    const auto bits = MonoMask::word_bits;
+    const auto end = mask.width() - 1;
+    const auto top = mask.row(y);
+    const auto bottom = mask.row(y + 1);
+    const auto words = mask.words_per_row();
+    // the pixels right of the pixels in the word
+    const auto right = [&](const Word* row, int i) {
+      return (row[i] >> 1) | (i + 1 < words ? row[i + 1] << (bits - 1) : Word{ });
+    };
+    for (auto i = begin / bits; i * bits < end; ++i) {
+      const auto a = top[i];
+      const auto b = right(top, i);
+      const auto c = bottom[i];
+      const auto d = right(bottom, i);
+      auto gaps = ~(a ^ d) & ~(b ^ c) & (a ^ b);
+      if (i == begin / bits)
+        gaps &= ~Word{ } << (begin % bits);
+      if (gaps)
+        return std::min(i * bits + MonoMask::lowest_bit(gaps), end);
+    }
+    return end;
   }
 
-  PolylinePtr simplify_polygon(const cpPolyline& polyline, float tolerance) {
-    return PolylinePtr(cpPolylineSimplifyCurves(
-      const_cast<cpPolyline*>(&polyline), tolerance));
+  // 2x2 blocks with only the diagonal pixels used are filled up,
+  // so the outlines of the islands are simple and do not touch
+  void fill_diagonal_gaps(MonoMask& mask) {
+    // filling a pixel can create gaps in the blocks containing it
+    auto blocks = std::vector<Point>();
+    const auto end = mask.width() - 1;
+    for (auto y = 0; y < mask.height() - 1; ++y)
+      for (auto x = find_diagonal_gap(mask, y, 0); x < end;
+           x = find_diagonal_gap(mask, y, x + 1)) {
+        blocks.push_back({ x, y });
+        while (!blocks.empty()) {
+          const auto [bx, by] = blocks.back();
+          blocks.pop_back();
+          const auto a = mask.test(bx, by);
+          const auto b = mask.test(bx + 1, by);
+          const auto c = mask.test(bx, by + 1);
+          const auto d = mask.test(bx + 1, by + 1);
+          if (a != d || b != c || a == b)
+            continue;
+          const auto fill = (a ? Point{ bx + 1, by } : Point{ bx, by });
+          mask.set(fill.x, fill.y);
+          for (auto ny = std::max(fill.y - 1, 0); ny <= std::min(fill.y, mask.height() - 2); ++ny)
+            for (auto nx = std::max(fill.x - 1, 0); nx <= std::min(fill.x, end - 1); ++nx)
+              blocks.push_back({ nx, ny });
+        }
+      }
   }
 
-  std::vector<PointF> to_point_list(const cpPolyline& polyline) {
-    auto vertices = std::vector<PointF>();
-    vertices.reserve(static_cast<size_t>(polyline.count));
-    for (auto i = 0; i < polyline.count; ++i)
-      vertices.push_back({
-        static_cast<float>(polyline.verts[i].x),
-        static_cast<float>(polyline.verts[i].y)
+  MonoMask get_mesh_mask(const ImageView& image, bool gray_levels,
+      int threshold, int margin) {
+    auto mask = get_used_mask(image, gray_levels, threshold);
+    if (margin)
+      mask = dilate_columns(dilate_rows(mask, margin), margin);
+    fill_diagonal_gaps(mask);
+    return mask;
+  }
+
+  // follows the outline of an island clockwise, beginning at the top left
+  // corner of its first pixel. returns the corners
+  Polygon trace_outline(const MonoMask& mask, Point start) {
+    // east, south, west, north and the pixels ahead right and ahead left
+    const Point steps[] = { { 1, 0 }, { 0, 1 }, { -1, 0 }, { 0, -1 } };
+    const Point ahead_right[] = { { 0, 0 }, { -1, 0 }, { -1, -1 }, { 0, -1 } };
+    const Point ahead_left[] = { { 0, -1 }, { 0, 0 }, { -1, 0 }, { -1, -1 } };
+
+    auto outline = Polygon{ { static_cast<double>(start.x), static_cast<double>(start.y) } };
+    auto position = start;
+    auto direction = 0;
+    for (;;) {
+      position.x += steps[direction].x;
+      position.y += steps[direction].y;
+      if (position.x == start.x && position.y == start.y)
+        return outline;
+
+      const auto& right = ahead_right[direction];
+      const auto& left = ahead_left[direction];
+      if (!mask.test(position.x + right.x, position.y + right.y))
+        direction = (direction + 1) % 4;
+      else if (mask.test(position.x + left.x, position.y + left.y))
+        direction = (direction + 3) % 4;
+      else
+        continue;
+      outline.push_back({ static_cast<double>(position.x),
+                          static_cast<double>(position.y) });
+    }
+  }
+
+  bool is_inside(const Polygon& polygon, const Vector& point) {
+    auto inside = false;
+    for (auto i = size_t{ }, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+      const auto& a = polygon[i];
+      const auto& b = polygon[j];
+      if ((a.y > point.y) != (b.y > point.y) &&
+          point.x < (b.x - a.x) * (point.y - a.y) / (b.y - a.y) + a.x)
+        inside = !inside;
+    }
+    return inside;
+  }
+
+  // returns the outer outlines of the islands, islands within the holes
+  // of others are omitted
+  std::vector<Polygon> get_island_outlines(const MonoMask& mask) {
+    // the runs of used pixels are joined with the overlapping runs of
+    // the previous row. the root is the island's first run
+    auto runs = std::vector<RowSpan>();
+    auto parents = std::vector<size_t>();
+    const auto find_root = [&](size_t index) {
+      while (parents[index] != index)
+        index = parents[index] = parents[parents[index]];
+      return index;
+    };
+    auto previous = size_t{ };
+    for (auto y = 0; y < mask.height(); ++y) {
+      const auto row_begin = runs.size();
+      for (auto x = mask.find_set(y, 0); x < mask.width(); x = mask.find_set(y, x)) {
+        const auto end = mask.find_unset(y, x);
+        const auto index = runs.size();
+        runs.push_back({ y, x, end });
+        parents.push_back(index);
+        for (; previous < row_begin && runs[previous].x1 <= x; ++previous) { }
+        for (auto i = previous; i < row_begin && runs[i].x0 < end; ++i) {
+          const auto a = find_root(i);
+          const auto b = find_root(index);
+          parents[std::max(a, b)] = std::min(a, b);
+        }
+        x = end;
+      }
+      previous = row_begin;
+    }
+
+    auto outlines = std::vector<Polygon>();
+    auto starts = std::vector<Vector>();
+    for (auto i = size_t{ }; i < runs.size(); ++i)
+      if (find_root(i) == i) {
+        outlines.push_back(trace_outline(mask, { runs[i].x0, runs[i].y }));
+        starts.push_back({ runs[i].x0 + 0.5, runs[i].y + 0.5 });
+      }
+
+    auto nested = std::vector<bool>(outlines.size());
+    for (auto i = size_t{ }; i < outlines.size(); ++i)
+      for (auto j = size_t{ }; j < outlines.size() && !nested[i]; ++j)
+        nested[i] = (i != j && is_inside(outlines[j], starts[i]));
+
+    auto outer = std::vector<Polygon>();
+    for (auto i = size_t{ }; i < outlines.size(); ++i)
+      if (!nested[i])
+        outer.push_back(std::move(outlines[i]));
+    return outer;
+  }
+
+  bool is_in_triangle(const Vector& p, const Vector& a, const Vector& b, const Vector& c) {
+    const auto d0 = cross(b - a, p - a);
+    const auto d1 = cross(c - b, p - b);
+    const auto d2 = cross(a - c, p - c);
+    return !((d0 < 0 || d1 < 0 || d2 < 0) && (d0 > 0 || d1 > 0 || d2 > 0));
+  }
+
+  bool segments_touch(const Vector& a, const Vector& b, const Vector& c, const Vector& d) {
+    const auto d0 = cross(b - a, c - a);
+    const auto d1 = cross(b - a, d - a);
+    const auto d2 = cross(d - c, a - c);
+    const auto d3 = cross(d - c, b - c);
+    if (((d0 > 0 && d1 < 0) || (d0 < 0 && d1 > 0)) &&
+        ((d2 > 0 && d3 < 0) || (d2 < 0 && d3 > 0)))
+      return true;
+    const auto on_segment = [](const Vector& p, const Vector& q, const Vector& r) {
+      return (std::min(p.x, q.x) <= r.x && r.x <= std::max(p.x, q.x) &&
+              std::min(p.y, q.y) <= r.y && r.y <= std::max(p.y, q.y));
+    };
+    return ((d0 == 0 && on_segment(a, b, c)) || (d1 == 0 && on_segment(a, b, d)) ||
+            (d2 == 0 && on_segment(c, d, a)) || (d3 == 0 && on_segment(c, d, b)));
+  }
+
+  // greedily reduces the vertices of clockwise outlines, by the operation
+  // which adds the least area. concave vertices are removed and edges
+  // between two convex vertices are replaced by the intersection of the
+  // neighboring edges. both only extend the outlines, which must not
+  // overlap or leave the bounds
+  class OutlineReducer {
+  public:
+    OutlineReducer(const std::vector<Polygon>& outlines, double width, double height)
+      : m_width(width), m_height(height) {
+      for (const auto& outline : outlines) {
+        const auto begin = m_vertices.size();
+        for (auto i = size_t{ }; i < outline.size(); ++i)
+          m_vertices.push_back({ outline[i],
+            begin + (i + outline.size() - 1) % outline.size(),
+            begin + (i + 1) % outline.size(), m_outline_sizes.size() });
+        m_outline_sizes.push_back(outline.size());
+        m_count += outline.size();
+      }
+
+      // vertices are bucketed in a grid for finding them in an area
+      m_cell_size = std::max(4.0, 2 * std::sqrt(width * height /
+        static_cast<double>(std::max(m_count, size_t{ 1 }))));
+      m_columns = static_cast<int>(width / m_cell_size) + 1;
+      m_rows = static_cast<int>(height / m_cell_size) + 1;
+      m_cells.resize(static_cast<size_t>(m_columns * m_rows));
+      for (auto i = size_t{ }; i < m_vertices.size(); ++i) {
+        get_cell(position(i)).push_back(i);
+        m_max_edge = std::max(m_max_edge, length(position(next(i)) - position(i)));
+      }
+    }
+
+    size_t vertex_count() const { return m_count; }
+
+    void reduce(size_t max_vertices) {
+      for (auto i = size_t{ }; i < m_vertices.size(); ++i)
+        evaluate(i);
+
+      while (m_count > max_vertices && !m_queue.empty()) {
+        const auto candidate = m_queue.top();
+        m_queue.pop();
+        auto& v = m_vertices[candidate.vertex];
+        if (v.removed || v.version != candidate.version)
+          continue;
+        if (candidate.collapse ? collapse(candidate.vertex) : remove(candidate.vertex))
+          --m_count;
+      }
+    }
+
+    std::vector<Polygon> outlines() const {
+      auto outlines = std::vector<Polygon>(m_outline_sizes.size());
+      for (auto i = size_t{ }; i < m_vertices.size(); ++i) {
+        auto& outline = outlines[m_vertices[i].outline];
+        if (m_vertices[i].removed || !outline.empty())
+          continue;
+        auto index = i;
+        do {
+          outline.push_back(position(index));
+          index = next(index);
+        } while (index != i);
+      }
+      return outlines;
+    }
+
+  private:
+    struct Vertex {
+      Vector position;
+      size_t prev;
+      size_t next;
+      size_t outline;
+      bool removed{ };
+      uint32_t version{ };
+    };
+    struct Candidate {
+      double cost;
+      size_t vertex;
+      uint32_t version;
+      bool collapse;
+
+      bool operator<(const Candidate& other) const {
+        return std::tie(other.cost, other.vertex) < std::tie(cost, vertex);
+      }
+    };
+
+    std::vector<size_t>& get_cell(const Vector& p) {
+      const auto x = std::clamp(static_cast<int>(p.x / m_cell_size), 0, m_columns - 1);
+      const auto y = std::clamp(static_cast<int>(p.y / m_cell_size), 0, m_rows - 1);
+      return m_cells[static_cast<size_t>(y * m_columns + x)];
+    }
+
+    void remove_from_cell(size_t index) {
+      auto& cell = get_cell(position(index));
+      *std::find(cell.begin(), cell.end(), index) = cell.back();
+      cell.pop_back();
+    }
+
+    // returns whether the predicate is true for a vertex within the bounds
+    template <typename P>
+    bool any_vertex(const Vector& min, const Vector& max, P&& predicate) const {
+      const auto x0 = std::clamp(static_cast<int>(min.x / m_cell_size), 0, m_columns - 1);
+      const auto y0 = std::clamp(static_cast<int>(min.y / m_cell_size), 0, m_rows - 1);
+      const auto x1 = std::clamp(static_cast<int>(max.x / m_cell_size), 0, m_columns - 1);
+      const auto y1 = std::clamp(static_cast<int>(max.y / m_cell_size), 0, m_rows - 1);
+      for (auto y = y0; y <= y1; ++y)
+        for (auto x = x0; x <= x1; ++x)
+          for (auto index : m_cells[static_cast<size_t>(y * m_columns + x)])
+            if (predicate(index))
+              return true;
+      return false;
+    }
+
+    const Vector& position(size_t index) const { return m_vertices[index].position; }
+    size_t prev(size_t index) const { return m_vertices[index].prev; }
+    size_t next(size_t index) const { return m_vertices[index].next; }
+
+    // the point where the edges before and after the edge b-c meet
+    std::optional<Vector> get_collapse_point(size_t b) const {
+      const auto a = prev(b);
+      const auto c = next(b);
+      const auto d = next(c);
+      const auto u = position(b) - position(a);
+      const auto w = position(c) - position(d);
+      const auto e = position(c) - position(b);
+      const auto denominator = cross(u, w);
+      if (denominator == 0)
+        return { };
+      const auto t = cross(e, w) / denominator;
+      const auto s = cross(e, u) / denominator;
+      if (t <= 0 || s <= 0)
+        return { };
+      const auto p = Vector{ position(b).x + t * u.x, position(b).y + t * u.y };
+      if (p.x < 0 || p.y < 0 || p.x > m_width || p.y > m_height)
+        return { };
+      return p;
+    }
+
+    void evaluate(size_t b) {
+      auto& vertex = m_vertices[b];
+      ++vertex.version;
+      if (m_outline_sizes[vertex.outline] <= 3)
+        return;
+
+      const auto a = prev(b);
+      const auto c = next(b);
+      const auto turn = cross(position(b) - position(a), position(c) - position(b));
+      if (turn <= 0) {
+        m_queue.push({ -turn / 2, b, vertex.version, false });
+      }
+      else if (cross(position(c) - position(b), position(next(c)) - position(c)) > 0) {
+        if (const auto p = get_collapse_point(b))
+          m_queue.push({ std::fabs(cross(*p - position(b), position(c) - position(b))) / 2,
+            b, vertex.version, true });
+      }
+    }
+
+    void evaluate_around(size_t index) {
+      for (auto i = 0; i < 2; ++i)
+        index = prev(index);
+      for (auto i = 0; i < 5; ++i, index = next(index))
+        evaluate(index);
+    }
+
+    bool is_any_inside(const Vector& a, const Vector& b, const Vector& c,
+        std::initializer_list<size_t> except) const {
+      const auto min = Vector{ std::min({ a.x, b.x, c.x }), std::min({ a.y, b.y, c.y }) };
+      const auto max = Vector{ std::max({ a.x, b.x, c.x }), std::max({ a.y, b.y, c.y }) };
+      return any_vertex(min, max, [&](size_t index) {
+        return (std::find(except.begin(), except.end(), index) == except.end() &&
+                is_in_triangle(position(index), a, b, c));
       });
-    return vertices;
+    }
+
+    bool remove(size_t b) {
+      const auto a = prev(b);
+      const auto c = next(b);
+      // no other vertex inside the added triangle, means no edge crosses it
+      if (is_any_inside(position(a), position(b), position(c), { a, b, c }))
+        return false;
+      unlink(b);
+      m_max_edge = std::max(m_max_edge, length(position(c) - position(a)));
+      evaluate_around(a);
+      return true;
+    }
+
+    bool collapse(size_t b) {
+      const auto a = prev(b);
+      const auto c = next(b);
+      const auto d = next(c);
+      const auto p = get_collapse_point(b);
+      if (!p || is_any_inside(position(b), *p, position(c), { a, b, c, d }))
+        return false;
+
+      // edges crossing the new edges begin within the longest edge length
+      const auto& e = position(b);
+      const auto& f = position(c);
+      const auto min = Vector{ std::min({ e.x, p->x, f.x }) - m_max_edge,
+                               std::min({ e.y, p->y, f.y }) - m_max_edge };
+      const auto max = Vector{ std::max({ e.x, p->x, f.x }) + m_max_edge,
+                               std::max({ e.y, p->y, f.y }) + m_max_edge };
+      if (any_vertex(min, max, [&](size_t i) {
+            return (i != a && i != b && i != c &&
+              (segments_touch(position(i), position(next(i)), e, *p) ||
+               segments_touch(position(i), position(next(i)), *p, f)));
+          }))
+        return false;
+
+      remove_from_cell(b);
+      m_vertices[b].position = *p;
+      get_cell(*p).push_back(b);
+      unlink(c);
+      m_max_edge = std::max({ m_max_edge,
+        length(*p - position(a)), length(position(d) - *p) });
+      evaluate_around(b);
+      return true;
+    }
+
+    void unlink(size_t index) {
+      remove_from_cell(index);
+      auto& vertex = m_vertices[index];
+      m_vertices[vertex.prev].next = vertex.next;
+      m_vertices[vertex.next].prev = vertex.prev;
+      vertex.removed = true;
+      --m_outline_sizes[vertex.outline];
+    }
+
+    const double m_width;
+    const double m_height;
+    double m_cell_size{ };
+    int m_columns{ };
+    int m_rows{ };
+    std::vector<std::vector<size_t>> m_cells;
+    double m_max_edge{ };
+    std::vector<Vertex> m_vertices;
+    std::vector<size_t> m_outline_sizes;
+    size_t m_count{ };
+    std::priority_queue<Candidate> m_queue;
+  };
+
+  // ear clipping of a clockwise outline
+  void triangulate(const Polygon& outline, int offset, std::vector<int>& triangles) {
+    auto indices = std::vector<int>(outline.size());
+    std::iota(indices.begin(), indices.end(), 0);
+    const auto add_triangle = [&](size_t i) {
+      const auto n = indices.size();
+      for (auto corner : { (i + n - 1) % n, i, (i + 1) % n })
+        triangles.push_back(offset + indices[corner]);
+      indices.erase(indices.begin() + static_cast<std::ptrdiff_t>(i));
+    };
+    const auto is_ear = [&](size_t i) {
+      const auto n = indices.size();
+      const auto& a = outline[static_cast<size_t>(indices[(i + n - 1) % n])];
+      const auto& b = outline[static_cast<size_t>(indices[i])];
+      const auto& c = outline[static_cast<size_t>(indices[(i + 1) % n])];
+      if (cross(b - a, c - b) <= 0)
+        return false;
+      for (auto j = size_t{ 2 }; j < n - 1; ++j)
+        if (is_in_triangle(outline[static_cast<size_t>(indices[(i + j) % n])], a, b, c))
+          return false;
+      return true;
+    };
+
+    auto i = size_t{ };
+    auto tested = size_t{ };
+    while (indices.size() > 3) {
+      if (is_ear(i) || tested > indices.size()) {
+        add_triangle(i);
+        i %= indices.size();
+        tested = 0;
+      }
+      else {
+        i = (i + 1) % indices.size();
+        ++tested;
+      }
+    }
+    add_triangle(1);
+  }
+
+  void create_mesh(Sprite& sprite) {
+    const auto rect = sprite.trimmed_source_rect;
+    const auto mask = get_mesh_mask(ImageView(*sprite.source, rect),
+      sprite.trim_gray_levels, sprite.trim_threshold, sprite.trim_margin);
+    auto outlines = get_island_outlines(mask);
+    if (outlines.empty())
+      return;
+
+    const auto w = static_cast<double>(rect.w);
+    const auto h = static_cast<double>(rect.h);
+    const auto max_vertices = static_cast<size_t>(sprite.trim_max_vertices);
+    auto reducer = OutlineReducer(outlines, w, h);
+    reducer.reduce(max_vertices);
+    outlines = reducer.outlines();
+
+    // otherwise continue with the hull of all islands, finally the rect
+    if (reducer.vertex_count() > max_vertices) {
+      auto points = Polygon();
+      for (const auto& outline : outlines)
+        points.insert(points.end(), outline.begin(), outline.end());
+      auto hull = get_convex_hull(std::move(points));
+      hull.pop_back();
+      auto hull_reducer = OutlineReducer({ hull }, w, h);
+      hull_reducer.reduce(max_vertices);
+      outlines = hull_reducer.outlines();
+      if (hull_reducer.vertex_count() > max_vertices)
+        outlines = { { { 0, 0 }, { w, 0 }, { w, h }, { 0, h } } };
+    }
+
+    sprite.vertices.clear();
+    sprite.triangles.clear();
+    for (const auto& outline : outlines) {
+      if (outline.empty())
+        continue;
+      triangulate(outline, static_cast<int>(sprite.vertices.size()), sprite.triangles);
+      const auto vertices = to_point_list(outline);
+      sprite.vertices.insert(sprite.vertices.end(), vertices.begin(), vertices.end());
+    }
+  }
+
+  void wait_source_loaded(Sprite& sprite) {
+    // source might still be decoded in background
+    if (sprite.source_loaded.valid()) {
+      thread_pool().wait(sprite.source_loaded);
+      sprite.source_loaded.get();
+    }
   }
 } // namespace
 
 void trim_sprite(Sprite& sprite) {
+  wait_source_loaded(sprite);
 
   if (sprite.trim == Trim::none) {
     sprite.trimmed_source_rect = sprite.source_rect;
     return;
   }
 
-  sprite.trimmed_source_rect = get_used_bounds(*sprite.source,
-    sprite.trim_gray_levels, sprite.trim_threshold, sprite.source_rect);
+  sprite.trimmed_source_rect = (sprite.source_occupancy ?
+    sprite.source_occupancy->get_used_bounds(sprite.source_rect) :
+    get_used_bounds(*sprite.source, sprite.trim_gray_levels,
+      sprite.trim_threshold, sprite.source_rect));
 
   if (sprite.trim_margin)
     sprite.trimmed_source_rect = intersect(expand(
       sprite.trimmed_source_rect, sprite.trim_margin), sprite.source_rect);
 
   if (sprite.trim == Trim::convex) {
-    const auto levels = (sprite.trim_gray_levels ?
-      get_gray_levels(*sprite.source, sprite.trimmed_source_rect) :
-      get_alpha_levels(*sprite.source, sprite.trimmed_source_rect));
-
-    auto outline = get_polygon_outline(levels, sprite.trim_threshold);
-    outline = to_convex_polygon(*outline, 0);
-    outline = simplify_polygon(*outline, 3);
-    expand_polygon(*outline, static_cast<float>(sprite.trim_margin));
-    sprite.vertices = to_point_list(*outline);
+    auto outline = get_convex_outline(
+      ImageView(*sprite.source, sprite.trimmed_source_rect),
+      sprite.trim_gray_levels, sprite.trim_threshold);
+    if (outline.empty())
+      return;
+    outline = simplify_polygon(outline, 3);
+    expand_polygon(outline, static_cast<float>(sprite.trim_margin));
+    sprite.vertices = to_point_list(outline);
+  }
+  else if (sprite.trim == Trim::mesh) {
+    create_mesh(sprite);
   }
 }
 
+void trim_sprites(SpriteSpan sprites) {
+  for_each_parallel(sprites.begin(), sprites.end(),
+    [](Sprite& sprite) {
+      // time spent waiting for the decoding is not attributed to trimming
+      wait_source_loaded(sprite);
+      {
+        auto scope = StageScope(Stage::trim, sprite.id);
+        trim_sprite(sprite);
+        if (stats_enabled())
+          add_trimmed_sprite(sprite, scope.elapsed());
+      }
+      // for finding duplicates while packing
+      if (sprite.texture && sprite.texture->duplicates != Duplicates::keep) {
+        auto scope = StageScope(Stage::deduplicate,
+          sprite.texture->filename.filename());
+        sprite.trimmed_hash = get_pixel_hash(*sprite.source,
+          sprite.trimmed_source_rect);
+      }
+    });
+}
+
 } // namespace
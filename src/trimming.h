@@ -4,6 +4,7 @@
 
 namespace spright {
 
-void trim_sprite(Sprite& sprites);
+void trim_sprite(Sprite& sprite);
+void trim_sprites(SpriteSpan sprites);
 
 } // namespace
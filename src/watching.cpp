@@ -0,0 +1,148 @@
+
+#include "watching.h"
+#include "common.h"
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__linux__)
+# include <cerrno>
+# include <poll.h>
+# include <sys/inotify.h>
+# include <unistd.h>
+#endif
+
+namespace spright {
+
+namespace {
+  // events arriving within this time after a change are handled together
+  const auto settle_time_ms = 100;
+
+  bool is_in_directory(const std::filesystem::path& directory,
+      const std::filesystem::path& filename) {
+    const auto [it, _] = std::mismatch(directory.begin(), directory.end(),
+      filename.begin(), filename.end());
+    return (it == directory.end());
+  }
+} // namespace
+
+#if defined(__linux__)
+
+FileWatcher::FileWatcher()
+  : m_fd(inotify_init1(IN_CLOEXEC)) {
+  if (m_fd < 0)
+    throw std::runtime_error("watching files failed");
+}
+
+FileWatcher::~FileWatcher() {
+  ::close(m_fd);
+}
+
+void FileWatcher::add_watch(const std::filesystem::path& directory) {
+  const auto mask = static_cast<uint32_t>(IN_CLOSE_WRITE | IN_CREATE |
+    IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+  const auto wd = inotify_add_watch(m_fd, path_to_utf8(directory).c_str(), mask);
+  if (wd >= 0)
+    m_watches[wd] = directory;
+}
+
+void FileWatcher::watch(const std::set<std::filesystem::path>& paths) {
+  m_files.clear();
+  m_directories.clear();
+  auto directories = std::set<std::filesystem::path>();
+  auto error = std::error_code{ };
+  for (const auto& path : paths) {
+    if (std::filesystem::is_directory(path, error)) {
+      m_directories.insert(path);
+      directories.insert(path);
+      const auto options =
+        std::filesystem::directory_options::follow_directory_symlink |
+        std::filesystem::directory_options::skip_permission_denied;
+      for (const auto& entry : std::filesystem::recursive_directory_iterator(
+            path, options, error))
+        if (entry.is_directory(error))
+          directories.insert(entry.path());
+    }
+    else {
+      m_files.insert(path);
+      directories.insert(path.parent_path());
+    }
+  }
+
+  // keep watches which are still needed, so events queued meanwhile are not lost
+  for (auto it = m_watches.begin(); it != m_watches.end(); )
+    if (!directories.count(it->second)) {
+      inotify_rm_watch(m_fd, it->first);
+      it = m_watches.erase(it);
+    }
+    else {
+      directories.erase(it->second);
+      ++it;
+    }
+  for (const auto& directory : directories)
+    add_watch(directory);
+}
+
+std::set<std::filesystem::path> FileWatcher::wait_for_changes(const Filter& ignore) {
+  auto changes = std::set<std::filesystem::path>();
+  alignas(inotify_event) char buffer[64 * 1024];
+  for (;;) {
+    // block until the first change, then until no further events arrive
+    auto fds = pollfd{ m_fd, POLLIN, 0 };
+    const auto result = ::poll(&fds, 1, (changes.empty() ? -1 : settle_time_ms));
+    if (result < 0 && errno == EINTR)
+      continue;
+    if (result < 0)
+      throw std::runtime_error("watching files failed");
+    if (result == 0)
+      return changes;
+
+    const auto size = ::read(m_fd, buffer, sizeof(buffer));
+    if (size <= 0)
+      throw std::runtime_error("watching files failed");
+
+    for (auto offset = ssize_t{ }; offset < size; ) {
+      const auto& event = *reinterpret_cast<const inotify_event*>(buffer + offset);
+      offset += static_cast<ssize_t>(sizeof(inotify_event) + event.len);
+
+      const auto it = m_watches.find(event.wd);
+      if (it == m_watches.end() || !event.len)
+        continue;
+
+      // within watched directories only adding and removing files matters
+      const auto filename = it->second / utf8_to_path(std::string_view(event.name));
+      if ((m_files.count(filename) ||
+           (!(event.mask & IN_CLOSE_WRITE) && is_in_watched_directory(filename))) &&
+          !(ignore && ignore(filename)))
+        changes.insert(filename);
+    }
+  }
+}
+
+#else // !__linux__
+
+FileWatcher::FileWatcher() {
+  throw std::runtime_error("watching files is not supported on this platform");
+}
+
+FileWatcher::~FileWatcher() = default;
+
+void FileWatcher::add_watch(const std::filesystem::path&) {
+}
+
+void FileWatcher::watch(const std::set<std::filesystem::path>&) {
+}
+
+std::set<std::filesystem::path> FileWatcher::wait_for_changes(const Filter&) {
+  return { };
+}
+
+#endif // !__linux__
+
+bool FileWatcher::is_in_watched_directory(const std::filesystem::path& filename) const {
+  return std::any_of(m_directories.begin(), m_directories.end(),
+    [&](const std::filesystem::path& directory) {
+      return is_in_directory(directory, filename);
+    });
+}
+
+} // namespace
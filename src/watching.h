@@ -0,0 +1,33 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <set>
+
+namespace spright {
+
+// waits for changes of files and for files added to or removed from directories
+class FileWatcher {
+public:
+  using Filter = std::function<bool(const std::filesystem::path&)>;
+
+  FileWatcher();
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+  ~FileWatcher();
+
+  void watch(const std::set<std::filesystem::path>& paths);
+  std::set<std::filesystem::path> wait_for_changes(const Filter& ignore);
+
+private:
+  void add_watch(const std::filesystem::path& directory);
+  bool is_in_watched_directory(const std::filesystem::path& filename) const;
+
+  int m_fd{ -1 };
+  std::map<int, std::filesystem::path> m_watches;
+  std::set<std::filesystem::path> m_files;
+  std::set<std::filesystem::path> m_directories;
+};
+
+} // namespace
@@ -0,0 +1,47 @@
+
+#include "catch.hpp"
+#include "src/InputParser.h"
+#include "src/caching.h"
+#include <sstream>
+
+using namespace spright;
+
+namespace {
+  uint64_t get_cache_key(const char* definition) {
+    auto input = std::stringstream(definition);
+    const auto settings = Settings{ };
+    auto parser = InputParser(settings);
+    parser.parse(input);
+    auto sprites = std::move(parser).sprites();
+    auto cache = BuildCache(settings);
+    return cache.get_key(sprites).hash;
+  }
+} // namespace
+
+TEST_CASE("caching - Key") {
+  const auto key = get_cache_key(R"(
+    input "test/Items.png"
+      sprite
+        rect 0 0 16 16
+  )");
+  CHECK(get_cache_key(R"(
+    input "test/Items.png"
+      sprite
+        rect 0 0 16 16
+  )") == key);
+
+  // the colorkey is applied when the sheet is decoded
+  const auto colorkey_key = get_cache_key(R"(
+    input "test/Items.png"
+      colorkey
+      sprite
+        rect 0 0 16 16
+  )");
+  CHECK(colorkey_key != key);
+  CHECK(get_cache_key(R"(
+    input "test/Items.png"
+      colorkey ff00ff
+      sprite
+        rect 0 0 16 16
+  )") != colorkey_key);
+}
@@ -0,0 +1,464 @@
+
+#include "catch.hpp"
+#include "src/image.h"
+#include <cstring>
+#include <random>
+
+using namespace spright;
+
+namespace {
+  Image get_random_image(int width, int height, std::mt19937& random) {
+    auto image = Image(width, height);
+    for (auto y = 0; y < height; ++y)
+      for (auto x = 0; x < width; ++x)
+        image.rgba_at({ x, y }).rgba = static_cast<uint32_t>(random());
+    return image;
+  }
+
+  bool point_in_polygon(float x, float y, const std::vector<PointF>& p) {
+    auto c = false;
+    for (auto i = size_t{ }, j = p.size() - 1; i < p.size(); j = i++) {
+      if ((((p[i].y <= y) && (y < p[j].y)) ||
+           ((p[j].y <= y) && (y < p[i].y))) &&
+          (x < (p[j].x - p[i].x) * (y - p[i].y) / (p[j].y - p[i].y) + p[i].x))
+        c = !c;
+    }
+    return c;
+  }
+} // namespace
+
+TEST_CASE("image - Rotated copy") {
+  auto random = std::mt19937(3);
+  const auto source = get_random_image(50, 40, random);
+  for (auto [w, h] : { std::pair{ 1, 1 }, { 3, 7 }, { 4, 4 }, { 16, 16 },
+                       { 17, 33 }, { 40, 21 }, { 50, 40 } }) {
+    const auto source_rect = Rect{ 50 - w, 40 - h, w, h };
+    auto dest = get_random_image(60, 60, random);
+    auto expected = dest.clone();
+    copy_rect_rotated_cw(source, source_rect, dest, 5, 3);
+    for (auto y = 0; y < h; ++y)
+      for (auto x = 0; x < w; ++x)
+        expected.rgba_at({ 5 + h - 1 - y, 3 + x }) =
+          source.rgba_at({ source_rect.x + x, source_rect.y + y });
+    CHECK(std::memcmp(dest.rgba(), expected.rgba(), 60 * 60 * sizeof(RGBA)) == 0);
+
+    // the mask is in dest coordinates and covers its left half
+    const auto mask_w = static_cast<float>(h) / 2;
+    const auto mask = std::vector<PointF>{ { 0, 0 },
+      { mask_w, 0 }, { mask_w, static_cast<float>(w) }, { 0, static_cast<float>(w) } };
+    dest = get_random_image(60, 60, random);
+    expected = dest.clone();
+    copy_rect_rotated_cw(source, source_rect, dest, 5, 3,
+      get_polygon_spans(mask, h, w));
+    for (auto y = 0; y < w; ++y)
+      for (auto x = 0; x < h; ++x)
+        if (static_cast<float>(x) + 0.5f < mask_w)
+          expected.rgba_at({ 5 + x, 3 + y }) =
+            source.rgba_at({ source_rect.x + y, source_rect.y + x });
+    CHECK(std::memcmp(dest.rgba(), expected.rgba(), 60 * 60 * sizeof(RGBA)) == 0);
+  }
+}
+
+TEST_CASE("image - Polygon spans") {
+  auto random = std::mt19937(4);
+  const auto coordinate = [&](int size) {
+    // also place vertices outside and exactly on pixel centers and edges
+    return static_cast<float>(static_cast<int>(random() % static_cast<unsigned>(size * 4 + 8)) - 4) / 4;
+  };
+  for (auto round = 0; round < 200; ++round) {
+    const auto width = static_cast<int>(1 + random() % 30);
+    const auto height = static_cast<int>(1 + random() % 30);
+    auto vertices = std::vector<PointF>(3 + random() % 6);
+    for (auto& vertex : vertices)
+      vertex = { coordinate(width), coordinate(height) };
+
+    auto mask = std::vector<bool>(static_cast<size_t>(width * height));
+    for (const auto& span : get_polygon_spans(vertices, width, height)) {
+      REQUIRE(span.y >= 0);
+      REQUIRE(span.y < height);
+      REQUIRE(span.x0 >= 0);
+      REQUIRE(span.x0 < span.x1);
+      REQUIRE(span.x1 <= width);
+      for (auto x = span.x0; x < span.x1; ++x)
+        mask[static_cast<size_t>(span.y * width + x)] = true;
+    }
+    for (auto y = 0; y < height; ++y)
+      for (auto x = 0; x < width; ++x)
+        CHECK(mask[static_cast<size_t>(y * width + x)] ==
+          point_in_polygon(static_cast<float>(x) + 0.5f,
+            static_cast<float>(y) + 0.5f, vertices));
+  }
+}
+
+TEST_CASE("image - Alpha filters") {
+  auto random = std::mt19937(5);
+  auto background = RGBA{ };
+  background.rgba = 0x80FF00FF;
+  for (auto count : { 0, 1, 3, 4, 5, 17, 64 }) {
+    auto pixels = std::vector<RGBA>(static_cast<size_t>(count));
+    for (auto& pixel : pixels) {
+      pixel.rgba = static_cast<uint32_t>(random());
+      if (random() % 3 == 0)
+        pixel.a = 0;
+    }
+
+    auto filtered = pixels;
+    filter_alpha(filtered.data(), count, AlphaFilter::clear);
+    for (auto i = 0; i < count; ++i) {
+      const auto& p = pixels[static_cast<size_t>(i)];
+      CHECK(filtered[static_cast<size_t>(i)] == (p.a ? p : RGBA{ }));
+    }
+
+    filtered = pixels;
+    filter_alpha(filtered.data(), count, AlphaFilter::opaque, background);
+    for (auto i = 0; i < count; ++i) {
+      auto expected = pixels[static_cast<size_t>(i)];
+      if (expected.a == 0)
+        expected = background;
+      else
+        expected.a = 255;
+      CHECK(filtered[static_cast<size_t>(i)] == expected);
+    }
+
+    filtered = pixels;
+    filter_alpha(filtered.data(), count, AlphaFilter::premultiply);
+    for (auto i = 0; i < count; ++i) {
+      auto expected = pixels[static_cast<size_t>(i)];
+      expected.r = static_cast<uint8_t>(expected.r * expected.a / 256);
+      expected.g = static_cast<uint8_t>(expected.g * expected.a / 256);
+      expected.b = static_cast<uint8_t>(expected.b * expected.a / 256);
+      CHECK(filtered[static_cast<size_t>(i)] == expected);
+    }
+  }
+}
+
+TEST_CASE("image - Bleed alpha") {
+  // fill ring by ring with the average color of the already set neighbors
+  const auto bleed_reference = [](Image& image, int radius) {
+    const auto w = image.width(), h = image.height();
+    auto set = std::vector<bool>(static_cast<size_t>(w * h));
+    for (auto i = 0; i < w * h; ++i)
+      set[static_cast<size_t>(i)] = (image.rgba()[i].a != 0);
+    for (auto distance = 1; !radius || distance <= radius; ++distance) {
+      auto ring = std::vector<std::pair<Point, RGBA>>();
+      for (auto y = 0; y < h; ++y)
+        for (auto x = 0; x < w; ++x) {
+          if (set[static_cast<size_t>(y * w + x)])
+            continue;
+          auto r = 0, g = 0, b = 0, count = 0;
+          for (auto ny = std::max(y - 1, 0); ny <= std::min(y + 1, h - 1); ++ny)
+            for (auto nx = std::max(x - 1, 0); nx <= std::min(x + 1, w - 1); ++nx)
+              if (set[static_cast<size_t>(ny * w + nx)]) {
+                const auto& color = image.rgba_at({ nx, ny });
+                r += color.r;
+                g += color.g;
+                b += color.b;
+                ++count;
+              }
+          if (count) {
+            auto color = image.rgba_at({ x, y });
+            color.r = static_cast<uint8_t>(r / count);
+            color.g = static_cast<uint8_t>(g / count);
+            color.b = static_cast<uint8_t>(b / count);
+            ring.push_back({ Point{ x, y }, color });
+          }
+        }
+      if (ring.empty())
+        break;
+      for (const auto& [point, color] : ring) {
+        image.rgba_at(point) = color;
+        set[static_cast<size_t>(point.y * w + point.x)] = true;
+      }
+    }
+  };
+
+  auto random = std::mt19937(6);
+  for (auto round = 0; round < 30; ++round) {
+    const auto width = static_cast<int>(1 + random() % 120);
+    const auto height = static_cast<int>(1 + random() % 120);
+    auto image = Image(width, height, RGBA{ });
+    auto regions = std::vector<Rect>();
+    for (auto i = random() % 4; i > 0; --i) {
+      const auto rect = Rect{
+        static_cast<int>(random() % static_cast<unsigned>(width)),
+        static_cast<int>(random() % static_cast<unsigned>(height)), 5, 5 };
+      const auto region = intersect(rect, image.bounds());
+      for (auto y = region.y; y < region.y + region.h; ++y)
+        for (auto x = region.x; x < region.x + region.w; ++x)
+          image.rgba_at({ x, y }).rgba = static_cast<uint32_t>(random()) |
+            (random() % 4 ? 0xFF000000u : 0u);
+      regions.push_back(region);
+    }
+    const auto radius = static_cast<int>(random() % 4);
+
+    auto expected = image.clone();
+    bleed_reference(expected, radius);
+    auto bled = image.clone();
+    bleed_alpha(bled, radius);
+    CHECK(std::memcmp(bled.rgba(), expected.rgba(),
+      static_cast<size_t>(width * height) * sizeof(RGBA)) == 0);
+    bleed_alpha(image, radius, regions);
+    CHECK(std::memcmp(image.rgba(), expected.rgba(),
+      static_cast<size_t>(width * height) * sizeof(RGBA)) == 0);
+  }
+
+  // scattered pixels, so the rings are filled in parallel
+  auto image = Image(300, 300, RGBA{ });
+  for (auto i = 0; i < 900; ++i)
+    image.rgba_at({ static_cast<int>(random() % 300), static_cast<int>(random() % 300) })
+      .rgba = static_cast<uint32_t>(random()) | 0xFF000000u;
+  auto expected = image.clone();
+  bleed_reference(expected, 0);
+  bleed_alpha(image);
+  CHECK(std::memcmp(image.rgba(), expected.rgba(), 300 * 300 * sizeof(RGBA)) == 0);
+}
+
+TEST_CASE("image - Find islands") {
+  // one random walk per cell, so the islands' bounds do not touch
+  auto random = std::mt19937(7);
+  const auto cell_size = 40;
+  auto image = Image(cell_size * 7, cell_size * 5, RGBA{ });
+  auto expected = std::vector<Rect>();
+  for (auto cy = 0; cy < 5; ++cy)
+    for (auto cx = 0; cx < 7; ++cx) {
+      auto x = cell_size / 2, y = cell_size / 2;
+      auto x0 = x, y0 = y, x1 = x, y1 = y;
+      for (auto i = 0; i < 200; ++i) {
+        image.rgba_at({ cx * cell_size + x, cy * cell_size + y }).a = 255;
+        x0 = std::min(x0, x);
+        y0 = std::min(y0, y);
+        x1 = std::max(x1, x);
+        y1 = std::max(y1, y);
+        // steps diagonally too, so islands are 8-connected
+        x = std::clamp(x + static_cast<int>(random() % 3) - 1, 2, cell_size - 3);
+        y = std::clamp(y + static_cast<int>(random() % 3) - 1, 2, cell_size - 3);
+      }
+      expected.push_back({ cx * cell_size + x0, cy * cell_size + y0,
+        x1 - x0 + 1, y1 - y0 + 1 });
+    }
+
+  const auto less = [](const Rect& a, const Rect& b) {
+    return std::tie(a.x, a.y, a.w, a.h) < std::tie(b.x, b.y, b.w, b.h);
+  };
+  auto islands = find_islands(image, 0, false, image.bounds());
+  std::sort(islands.begin(), islands.end(), less);
+  std::sort(expected.begin(), expected.end(), less);
+  CHECK(islands == expected);
+}
+
+TEST_CASE("image - Merge islands") {
+  // the former flood filling and pairwise merging
+  const auto find_islands_reference = [](const Image& image, int distance) {
+    const auto w = image.width(), h = image.height();
+    auto used = std::vector<bool>(static_cast<size_t>(w * h));
+    for (auto i = 0; i < w * h; ++i)
+      used[static_cast<size_t>(i)] = (image.rgba()[i].a != 0);
+    auto rects = std::vector<Rect>();
+    for (auto y = 0; y < h; ++y)
+      for (auto x = 0; x < w; ++x) {
+        if (!used[static_cast<size_t>(y * w + x)])
+          continue;
+        auto bounds = Rect{ x, y, 1, 1 };
+        auto stack = std::vector<Point>{ { x, y } };
+        used[static_cast<size_t>(y * w + x)] = false;
+        while (!stack.empty()) {
+          const auto p = stack.back();
+          stack.pop_back();
+          bounds = combine(bounds, { p.x, p.y, 1, 1 });
+          for (auto ny = std::max(p.y - 1, 0); ny <= std::min(p.y + 1, h - 1); ++ny)
+            for (auto nx = std::max(p.x - 1, 0); nx <= std::min(p.x + 1, w - 1); ++nx)
+              if (used[static_cast<size_t>(ny * w + nx)]) {
+                used[static_cast<size_t>(ny * w + nx)] = false;
+                stack.push_back({ nx, ny });
+              }
+        }
+        rects.push_back(bounds);
+      }
+
+    for (auto merged = true; merged; ) {
+      merged = false;
+      for (auto i = size_t{ }; i < rects.size(); ++i)
+        for (auto j = i + 1; j < rects.size(); ) {
+          const auto intersection = intersect(rects[i], expand(rects[j], distance));
+          if (!empty(intersection) && !is_fully_transparent(image, 1, intersection)) {
+            rects[i] = combine(rects[i], rects[j]);
+            rects[j] = rects.back();
+            rects.pop_back();
+            merged = true;
+          }
+          else {
+            ++j;
+          }
+        }
+    }
+
+    std::stable_sort(rects.begin(), rects.end(), [](const Rect& a, const Rect& b) {
+      const auto row_tolerance = std::min(a.h, b.h) / 4;
+      const auto ca = a.center();
+      const auto cb = b.center();
+      if (ca.y < cb.y - row_tolerance) return true;
+      if (cb.y < ca.y - row_tolerance) return false;
+      return std::tie(ca.x, ca.y) < std::tie(cb.x, cb.y);
+    });
+    return rects;
+  };
+
+  auto random = std::mt19937(8);
+  for (auto round = 0; round < 20; ++round) {
+    auto image = Image(200, 150, RGBA{ });
+    for (auto i = 0; i < 150; ++i) {
+      const auto rect = intersect(image.bounds(), {
+        static_cast<int>(random() % 200), static_cast<int>(random() % 150),
+        static_cast<int>(1 + random() % 6), static_cast<int>(1 + random() % 6) });
+      for (auto y = rect.y; y < rect.y + rect.h; ++y)
+        for (auto x = rect.x; x < rect.x + rect.w; ++x)
+          image.rgba_at({ x, y }).a = 255;
+    }
+    const auto distance = static_cast<int>(random() % 5);
+    const auto expected = find_islands_reference(image, distance);
+    CHECK(find_islands(image, distance, false, image.bounds()) == expected);
+    const auto index = OccupancyIndex(image, false, 1);
+    CHECK(find_islands(image, distance, false, image.bounds(), &index) == expected);
+  }
+}
+
+TEST_CASE("image - Views") {
+  auto random = std::mt19937(9);
+  auto image = Image(60, 40);
+  for (auto y = 0; y < image.height(); ++y)
+    for (auto x = 0; x < image.width(); ++x)
+      image.rgba_at({ x, y }).rgba = static_cast<uint32_t>(random() & 0x03FFFFFF);
+
+  const auto rect = Rect{ 7, 5, 33, 21 };
+  const auto view = ImageView(image, rect);
+  CHECK(view.width() == rect.w);
+  CHECK(view.height() == rect.h);
+  CHECK(view.stride() == image.width());
+  CHECK(&view.rgba_at({ 3, 2 }) == &image.rgba_at({ rect.x + 3, rect.y + 2 }));
+  CHECK(&view.subview({ 1, 2, 3, 4 }).rgba_at({ 0, 0 }) ==
+    &image.rgba_at({ rect.x + 1, rect.y + 2 }));
+  CHECK_THROWS(view.subview({ 1, 2, rect.w, 4 }));
+
+  // operating on a view equals operating on the rect of the image
+  const auto inner = Rect{ 2, 3, 20, 10 };
+  const auto outer = Rect{ rect.x + inner.x, rect.y + inner.y, inner.w, inner.h };
+  CHECK(get_pixel_hash(view, inner) == get_pixel_hash(image, outer));
+  CHECK(is_identical(view, inner, image, outer));
+  CHECK(get_used_bounds(view, false, 3, inner).x == get_used_bounds(image, false, 3, outer).x - rect.x);
+  CHECK(find_islands(view, 0, false, view.bounds()).size() ==
+    find_islands(image, 0, false, rect).size());
+
+  auto copy = Image(rect.w, rect.h);
+  copy_rect(view, view.bounds(), copy, 0, 0);
+  CHECK(is_identical(copy, copy.bounds(), image, rect));
+}
+
+TEST_CASE("image - Occupancy index") {
+  auto random = std::mt19937(5);
+  for (auto round = 0; round < 20; ++round) {
+    // sparse used pixels, so rects are frequently unused
+    auto image = Image(73, 41);
+    for (auto y = 0; y < image.height(); ++y)
+      for (auto x = 0; x < image.width(); ++x)
+        if (random() % 50 == 0)
+          image.rgba_at({ x, y }).rgba = static_cast<uint32_t>(random());
+
+    const auto view = ImageView(image, { 3, 2, 61, 37 });
+    const auto gray_levels = (round % 2 != 0);
+    const auto threshold = static_cast<int>(random() % 255) + 1;
+    const auto index = OccupancyIndex(view, gray_levels, threshold);
+    CHECK(index.bounds() == view.bounds());
+    CHECK(index.get_used_bounds() == get_used_bounds(view, gray_levels, threshold));
+
+    for (auto i = 0; i < 100; ++i) {
+      const auto x = static_cast<int>(random() % 61);
+      const auto y = static_cast<int>(random() % 37);
+      const auto rect = Rect{ x, y,
+        static_cast<int>(random() % static_cast<uint32_t>(61 - x)) + 1,
+        static_cast<int>(random() % static_cast<uint32_t>(37 - y)) + 1 };
+      CHECK(index.is_unused(rect) == (gray_levels ?
+        is_fully_black(view, threshold, rect) :
+        is_fully_transparent(view, threshold, rect)));
+      CHECK(index.get_used_bounds(rect) ==
+        get_used_bounds(view, gray_levels, threshold, rect));
+    }
+    CHECK_THROWS(index.is_unused({ 1, 1, 61, 1 }));
+
+    // index of a rect of the view
+    const auto part = Rect{ 5, 4, 40, 20 };
+    const auto part_index = OccupancyIndex(view, gray_levels, threshold, part);
+    CHECK(part_index.bounds() == part);
+    CHECK(part_index.get_used_bounds() == get_used_bounds(view, gray_levels, threshold, part));
+    for (auto i = 0; i < 100; ++i) {
+      const auto x = part.x + static_cast<int>(random() % 40);
+      const auto y = part.y + static_cast<int>(random() % 20);
+      const auto rect = Rect{ x, y,
+        static_cast<int>(random() % static_cast<uint32_t>(part.x1() - x)) + 1,
+        static_cast<int>(random() % static_cast<uint32_t>(part.y1() - y)) + 1 };
+      CHECK(part_index.is_unused(rect) == index.is_unused(rect));
+      CHECK(part_index.get_used_bounds(rect) == index.get_used_bounds(rect));
+    }
+    CHECK_THROWS(part_index.is_unused({ 0, 4, 10, 10 }));
+  }
+
+  // a few clusters, so tiles completely within the rects are used and unused
+  for (auto round = 0; round < 10; ++round) {
+    auto image = Image(150, 90, RGBA{ });
+    for (auto i = 0; i < 4; ++i) {
+      const auto x = static_cast<int>(random() % 140);
+      const auto y = static_cast<int>(random() % 80);
+      image.rgba_at({ x + static_cast<int>(random() % 10),
+        y + static_cast<int>(random() % 10) }).a = 255;
+    }
+    const auto index = OccupancyIndex(image, false, 1);
+    for (auto i = 0; i < 200; ++i) {
+      const auto x = static_cast<int>(random() % 150);
+      const auto y = static_cast<int>(random() % 90);
+      const auto rect = Rect{ x, y,
+        static_cast<int>(random() % static_cast<uint32_t>(150 - x)) + 1,
+        static_cast<int>(random() % static_cast<uint32_t>(90 - y)) + 1 };
+      CHECK(index.is_unused(rect) == is_fully_transparent(image, 1, rect));
+      CHECK(index.get_used_bounds(rect) == get_used_bounds(image, false, 1, rect));
+    }
+  }
+}
+
+TEST_CASE("image - Mono mask") {
+  auto random = std::mt19937(3);
+  for (auto width : { 1, 63, 64, 65, 130, 200 }) {
+    auto image = Image(width, 9);
+    for (auto y = 0; y < image.height(); ++y)
+      for (auto x = 0; x < image.width(); ++x)
+        if (random() % 3 == 0)
+          image.rgba_at({ x, y }).rgba = static_cast<uint32_t>(random());
+
+    const auto mask = get_used_mask(image, false, 100);
+    for (auto y = 0; y < image.height(); ++y) {
+      for (auto x = 0; x < width; ++x)
+        CHECK(mask.test(x, y) == (image.rgba_at({ x, y }).a >= 100));
+      for (auto x = 0; x <= width; ++x) {
+        auto set = x;
+        while (set < width && !mask.test(set, y))
+          ++set;
+        auto unset = x;
+        while (unset < width && mask.test(unset, y))
+          ++unset;
+        CHECK(mask.find_set(y, x) == set);
+        CHECK(mask.find_unset(y, x) == unset);
+      }
+    }
+    CHECK(!mask.test(-1, 0));
+    CHECK(!mask.test(width, 0));
+    CHECK(!mask.test(0, image.height()));
+
+    // runs are clamped and the bits right of the width stay unset
+    auto runs = MonoMask(width, 2);
+    runs.set_run(0, -5, width + 5);
+    runs.set_run(1, width / 3, width / 3 + 70);
+    CHECK(runs.find_unset(0, 0) == width);
+    CHECK(runs.find_set(1, 0) == width / 3);
+    CHECK(runs.find_unset(1, width / 3) == std::min(width / 3 + 70, width));
+    if (width % MonoMask::word_bits)
+      CHECK(runs.row(0)[runs.words_per_row() - 1] >> (width % MonoMask::word_bits) == 0);
+  }
+}
@@ -363,3 +363,67 @@ TEST_CASE("packing - Multiple sheets") {
   CHECK(textures[0].width <= 16);
   CHECK(textures[0].height <= 16);
 }
+
+TEST_CASE("packing - Best") {
+  const auto get_rects = [](const std::vector<PackedTexture>& textures) {
+    auto rects = std::vector<std::tuple<int, int, int, int, int, bool>>();
+    for (const auto& texture : textures)
+      for (const auto& sprite : texture.sprites)
+        rects.emplace_back(sprite.index, sprite.texture_index,
+          sprite.trimmed_rect.x, sprite.trimmed_rect.y,
+          texture.width * 1000 + texture.height, sprite.rotated);
+    std::sort(rects.begin(), rects.end());
+    return rects;
+  };
+
+  // fewest textures, then least area, then squarest
+  const auto get_score = [](const std::vector<PackedTexture>& textures) {
+    auto area = 0;
+    auto difference = 0;
+    for (const auto& texture : textures) {
+      area += texture.width * texture.height;
+      difference += std::abs(texture.width - texture.height);
+    }
+    return std::make_tuple(textures.size(), area, difference);
+  };
+
+  for (const auto* settings : {
+      R"(
+        allow-rotate
+        max-width 40
+        max-height 40
+        padding 1
+      )",
+      R"(
+        width 64
+        padding 1
+      )",
+      R"(
+        power-of-two
+      )" }) {
+    const auto input = std::string(R"(
+      input "test/Items.png"
+        colorkey
+        atlas
+    )");
+    const auto binpack = pack(("pack binpack" + std::string(settings) + input).c_str());
+    const auto binpack_score = get_score(binpack);
+
+    const auto definition = "pack best" + std::string(settings) + input;
+    const auto textures = pack(definition.c_str());
+    CHECK(get_score(textures) <= binpack_score);
+
+    // the result does not depend on the order in which candidates finish
+    const auto rects = get_rects(textures);
+    for (auto i = 0; i < 3; ++i)
+      CHECK(get_rects(pack(definition.c_str())) == rects);
+  }
+
+  auto texture = pack_single_sheet(R"(
+    pack best
+    input "test/Items.png"
+      sprite
+        rect 0 0 16 16
+  )");
+  CHECK(texture.sprites.size() == 1);
+}
@@ -0,0 +1,90 @@
+
+#include "catch.hpp"
+#include "src/scanning.h"
+#include "src/image.h"
+#include <random>
+
+using namespace spright;
+
+TEST_CASE("scanning - Kernels") {
+  const auto kernels = get_supported_scan_kernels();
+  REQUIRE(!kernels.empty());
+  const auto& scalar = *kernels.front();
+  CHECK(std::string(scalar.name) == "scalar");
+
+  auto random = std::mt19937(1);
+  auto pixels = std::vector<RGBA>(300);
+  for (auto count : { 0, 1, 3, 4, 15, 16, 17, 31, 33, 63, 64, 65, 100, 255, 300 })
+    for (auto round = 0; round < 20; ++round) {
+      // mostly values below the thresholds, with a few outliers
+      for (auto& pixel : pixels)
+        pixel.rgba = static_cast<uint32_t>(random()) & 0x3F3F3F3F;
+      for (auto i = 0; i < 2; ++i)
+        pixels[random() % pixels.size()].rgba = 0xFFFFFFFF;
+      if (round % 5 == 0)
+        pixels[static_cast<size_t>(std::max(count - 1, 0))].a = 200;
+      if (round % 5 == 1)
+        pixels[0].a = 200;
+
+      for (auto threshold : { 0, 1, 32, 64, 128, 255 })
+        for (const auto* kernel : kernels) {
+          INFO(kernel->name << " count " << count << " threshold " << threshold);
+          CHECK(kernel->find_alpha_at_least(pixels.data(), count, threshold) ==
+                scalar.find_alpha_at_least(pixels.data(), count, threshold));
+          CHECK(kernel->find_alpha_below(pixels.data(), count, threshold) ==
+                scalar.find_alpha_below(pixels.data(), count, threshold));
+          CHECK(kernel->find_gray_at_least(pixels.data(), count, threshold) ==
+                scalar.find_gray_at_least(pixels.data(), count, threshold));
+          CHECK(kernel->find_gray_below(pixels.data(), count, threshold) ==
+                scalar.find_gray_below(pixels.data(), count, threshold));
+          CHECK(kernel->find_last_alpha_at_least(pixels.data(), count, threshold) ==
+                scalar.find_last_alpha_at_least(pixels.data(), count, threshold));
+          CHECK(kernel->find_last_gray_at_least(pixels.data(), count, threshold) ==
+                scalar.find_last_gray_at_least(pixels.data(), count, threshold));
+        }
+    }
+
+  auto opaque = std::vector<RGBA>(100);
+  for (auto& pixel : opaque)
+    pixel.rgba = 0xFF1E140A;
+  for (const auto* kernel : kernels) {
+    CHECK(kernel->find_alpha_below(opaque.data(), 100, 255) == 100);
+    opaque[70].a = 254;
+    CHECK(kernel->find_alpha_below(opaque.data(), 100, 255) == 70);
+    opaque[70].a = 255;
+  }
+}
+
+TEST_CASE("scanning - Used bounds") {
+  // compare to the bounds of the used pixels
+  const auto get_expected = [](const Image& image, const Rect& rect) {
+    auto x0 = rect.x + rect.w, y0 = rect.y + rect.h, x1 = -1, y1 = -1;
+    for (auto y = rect.y; y < rect.y + rect.h; ++y)
+      for (auto x = rect.x; x < rect.x + rect.w; ++x)
+        if (image.rgba_at({ x, y }).a >= 1) {
+          x0 = std::min(x0, x);
+          y0 = std::min(y0, y);
+          x1 = std::max(x1, x);
+          y1 = std::max(y1, y);
+        }
+    if (y1 < 0)
+      return Rect{ rect.x + rect.w - 1, rect.y + rect.h - 1, 1, 1 };
+    return Rect{ x0, y0, x1 - x0 + 1, y1 - y0 + 1 };
+  };
+
+  auto random = std::mt19937(2);
+  for (auto round = 0; round < 200; ++round) {
+    const auto width = static_cast<int>(1 + random() % 80);
+    const auto height = static_cast<int>(1 + random() % 20);
+    auto image = Image(width, height, RGBA{ });
+    const auto used = static_cast<int>(random() % 5);
+    for (auto i = 0; i < used; ++i)
+      image.rgba_at({ static_cast<int>(random() % static_cast<unsigned>(width)),
+        static_cast<int>(random() % static_cast<unsigned>(height)) }).a = 255;
+
+    const auto rect = Rect{ 0, 1, width, height - 1 };
+    CHECK(get_used_bounds(image, false) == get_expected(image, image.bounds()));
+    if (!empty(rect))
+      CHECK(get_used_bounds(image, false, 1, rect) == get_expected(image, rect));
+  }
+}
@@ -0,0 +1,67 @@
+
+#include "catch.hpp"
+#include "src/ThreadPool.h"
+#include <numeric>
+
+using namespace spright;
+
+TEST_CASE("threading - for_each") {
+  for (auto thread_count : { 1, 2, 5 }) {
+    auto pool = ThreadPool(thread_count);
+    CHECK(pool.thread_count() == thread_count);
+
+    auto values = std::vector<int>(1000);
+    pool.for_each(values.size(), [&](size_t index) {
+      values[index] = static_cast<int>(index);
+    });
+    auto expected = std::vector<int>(values.size());
+    std::iota(expected.begin(), expected.end(), 0);
+    CHECK(values == expected);
+
+    pool.for_each(0, [](size_t) { FAIL(); });
+  }
+}
+
+TEST_CASE("threading - Nested") {
+  auto pool = ThreadPool(3);
+  auto sums = std::vector<int>(20);
+  pool.for_each(sums.size(), [&](size_t i) {
+    auto values = std::vector<int>(50);
+    pool.for_each(values.size(), [&](size_t j) {
+      values[j] = static_cast<int>(i + j);
+    });
+    sums[i] = std::accumulate(values.begin(), values.end(), 0);
+  });
+  for (auto i = 0; i < static_cast<int>(sums.size()); ++i)
+    CHECK(sums[static_cast<size_t>(i)] == i * 50 + 49 * 50 / 2);
+}
+
+TEST_CASE("threading - Exceptions") {
+  for (auto thread_count : { 1, 4 }) {
+    auto pool = ThreadPool(thread_count);
+    auto message = std::string();
+    try {
+      pool.for_each(100, [](size_t index) {
+        if (index % 10 == 7)
+          throw std::runtime_error(std::to_string(index));
+      });
+    }
+    catch (const std::exception& ex) {
+      message = ex.what();
+    }
+    CHECK(message == "7");
+  }
+}
+
+TEST_CASE("threading - Async") {
+  for (auto thread_count : { 1, 3 }) {
+    auto pool = ThreadPool(thread_count);
+    auto futures = std::vector<std::future<int>>();
+    for (auto i = 0; i < 10; ++i)
+      futures.push_back(pool.async([i]() { return i * i; }));
+    for (auto i = 0; i < 10; ++i) {
+      pool.wait(futures[static_cast<size_t>(i)]);
+      CHECK(futures[static_cast<size_t>(i)].get() == i * i);
+    }
+  }
+}
@@ -0,0 +1,270 @@
+
+#include "catch.hpp"
+#include "src/trimming.h"
+#include "chipmunk/chipmunk.h"
+extern "C" {
+#include "chipmunk/cpPolyline.h"
+#include "chipmunk/cpMarch.h"
+}
+#include <random>
+
+using namespace spright;
+
+namespace spright {
+  bool operator==(const PointF& a, const PointF& b) {
+    return (a.x == b.x && a.y == b.y);
+  }
+} // namespace
+
+namespace {
+  struct FreePolyline { void operator()(cpPolyline* line) { cpPolylineFree(line); }; };
+  using PolylinePtr = std::unique_ptr<cpPolyline, FreePolyline>;
+
+  // the former marching squares outline of the longest polyline
+  PolylinePtr get_polygon_outline_reference(const MonoImage& image, int threshold) {
+    const auto sample = [](cpVect point, void *data) -> cpFloat {
+      const auto& image = *static_cast<const MonoImage*>(data);
+      const auto x = static_cast<int>(point.x - 0.5);
+      const auto y = static_cast<int>(point.y - 0.5);
+      if (x < 0 || x >= image.width() || y < 0 || y >= image.height())
+        return 0;
+      return image.value_at({ x, y });
+    };
+
+    const auto outlines = cpPolylineSetNew();
+    cpMarchHard(
+      { -1, -1, static_cast<float>(image.width() + 1), static_cast<float>(image.height() + 1) },
+      static_cast<unsigned long>(image.width() + 3),
+      static_cast<unsigned long>(image.height() + 3),
+      static_cast<float>(threshold - 1),
+      reinterpret_cast<cpMarchSegmentFunc>(cpPolylineSetCollectSegment), outlines,
+      sample, const_cast<MonoImage*>(&image));
+
+    auto line = std::add_pointer_t<cpPolyline>{ };
+    for (auto i = 0; i < outlines->count; ++i) {
+      auto& current = *outlines->lines[i];
+      for (auto j = 0; j < current.count; ++j) {
+        current.verts[j].x = std::clamp(current.verts[j].x, cpFloat{ }, cpFloat(image.width()));
+        current.verts[j].y = std::clamp(current.verts[j].y, cpFloat{ }, cpFloat(image.height()));
+      }
+      if (!line || current.count > line->count)
+        line = &current;
+    }
+    auto outline = PolylinePtr(static_cast<cpPolyline*>(cpcalloc(1,
+      sizeof(cpPolyline) + static_cast<size_t>(line->count) * sizeof(cpVect))));
+    outline->capacity = line->count;
+    outline->count = line->count;
+    std::copy(line->verts, line->verts + line->count, outline->verts);
+    cpPolylineSetFree(outlines, true);
+    return outline;
+  }
+
+  cpVect normal(const cpVect& v) {
+    if (auto f = v.x * v.x + v.y * v.y; f != 0.0f) {
+      f = 1.0f / std::sqrt(f);
+      return { v.y * f, -v.x * f, };
+    }
+    return { 0, 0 };
+  }
+
+  std::vector<PointF> get_convex_vertices_reference(const Sprite& sprite) {
+    auto levels = (sprite.trim_gray_levels ?
+      get_gray_levels(*sprite.source, sprite.trimmed_source_rect) :
+      get_alpha_levels(*sprite.source, sprite.trimmed_source_rect));
+    auto outline = get_polygon_outline_reference(levels, sprite.trim_threshold);
+    outline = PolylinePtr(cpPolylineToConvexHull(outline.get(), 0));
+    outline = PolylinePtr(cpPolylineSimplifyCurves(outline.get(), 3));
+
+    auto& polyline = *outline;
+    if (auto distance = static_cast<float>(sprite.trim_margin) / 2; distance != 0) {
+      auto normals = std::vector<cpVect>();
+      for (auto i = 0; i < polyline.count; ++i) {
+        const auto& p0 = polyline.verts[i];
+        const auto& p1 = polyline.verts[(i + 1) %  polyline.count];
+        normals.push_back(normal({ p1.x - p0.x, p1.y - p0.y }));
+      }
+      for (auto i = size_t{ }; i < normals.size(); ++i) {
+        const auto& n0 = normals[i];
+        const auto& n1 = normals[(i - 1 + normals.size()) % normals.size()];
+        polyline.verts[i].x += (n0.x + n1.x) * distance;
+        polyline.verts[i].y += (n0.y + n1.y) * distance;
+      }
+    }
+    auto vertices = std::vector<PointF>();
+    for (auto i = 0; i < polyline.count; ++i)
+      vertices.push_back({
+        static_cast<float>(polyline.verts[i].x),
+        static_cast<float>(polyline.verts[i].y)
+      });
+    return vertices;
+  }
+
+  Sprite make_convex_sprite(std::shared_ptr<Image> image,
+      int margin, bool gray_levels) {
+    auto sprite = Sprite{ };
+    sprite.source = std::move(image);
+    sprite.source_rect = sprite.source->bounds();
+    sprite.trim = Trim::convex;
+    sprite.trim_margin = margin;
+    sprite.trim_threshold = 1;
+    sprite.trim_gray_levels = gray_levels;
+    return sprite;
+  }
+} // namespace
+
+TEST_CASE("trimming - Convex outline") {
+  auto random = std::mt19937(10);
+  for (auto round = 0; round < 200; ++round) {
+    // a single 4-connected blob of rects containing a center and wedges
+    const auto width = 1 + static_cast<int>(random() % 80);
+    const auto height = 1 + static_cast<int>(random() % 80);
+    auto image = std::make_shared<Image>(width, height, RGBA{ });
+    const auto rand = [&](int max) { return static_cast<int>(random() % static_cast<unsigned>(max)); };
+    const auto cx = rand(width);
+    const auto cy = rand(height);
+    const auto value = static_cast<uint8_t>(1 + rand(255));
+    const auto color = RGBA{ { value, value, value, 255 } };
+    for (auto i = 0; i < 1 + round % 5; ++i) {
+      const auto x0 = rand(cx + 1);
+      const auto y0 = rand(cy + 1);
+      const auto x1 = cx + rand(width - cx);
+      const auto y1 = cy + rand(height - cy);
+      fill_rect(*image, { x0, y0, x1 - x0 + 1, y1 - y0 + 1 }, color);
+      if (i % 2)
+        for (auto y = cy; y <= y1; ++y)
+          fill_rect(*image, { cx, y, std::min((y - cy) * i + 1, width - cx), 1 }, color);
+    }
+    const auto margin = static_cast<int>(random() % 3);
+    const auto gray_levels = (round % 4 == 0);
+    INFO("round " << round);
+
+    auto sprite = make_convex_sprite(image, margin, gray_levels);
+    trim_sprite(sprite);
+    CHECK(sprite.vertices == get_convex_vertices_reference(sprite));
+  }
+}
+
+TEST_CASE("trimming - Convex outline of islands") {
+  // the outline contains all islands, not just the biggest
+  auto image = std::make_shared<Image>(40, 30, RGBA{ });
+  fill_rect(*image, { 0, 0, 10, 10 }, RGBA{ { 255, 255, 255, 255 } });
+  fill_rect(*image, { 36, 27, 4, 3 }, RGBA{ { 255, 255, 255, 255 } });
+  auto sprite = make_convex_sprite(image, 0, false);
+  trim_sprite(sprite);
+  REQUIRE(!sprite.vertices.empty());
+  auto bounds = std::pair{ sprite.vertices.front(), sprite.vertices.front() };
+  for (const auto& vertex : sprite.vertices) {
+    bounds.first = { std::min(bounds.first.x, vertex.x), std::min(bounds.first.y, vertex.y) };
+    bounds.second = { std::max(bounds.second.x, vertex.x), std::max(bounds.second.y, vertex.y) };
+  }
+  CHECK(bounds.first == PointF{ 0, 0 });
+  CHECK(bounds.second == PointF{ 40, 30 });
+
+  // a fully transparent sprite keeps its rect
+  auto empty = make_convex_sprite(std::make_shared<Image>(8, 8, RGBA{ }), 0, false);
+  trim_sprite(empty);
+  CHECK(empty.vertices.empty());
+}
+
+namespace {
+  Sprite make_mesh_sprite(std::shared_ptr<Image> image, int max_vertices) {
+    auto sprite = make_convex_sprite(std::move(image), 0, false);
+    sprite.trim = Trim::mesh;
+    sprite.trim_max_vertices = max_vertices;
+    return sprite;
+  }
+
+  double get_mesh_area(const Sprite& sprite) {
+    auto area = 0.0;
+    for (auto i = size_t{ }; i + 2 < sprite.triangles.size(); i += 3) {
+      const auto& a = sprite.vertices[static_cast<size_t>(sprite.triangles[i])];
+      const auto& b = sprite.vertices[static_cast<size_t>(sprite.triangles[i + 1])];
+      const auto& c = sprite.vertices[static_cast<size_t>(sprite.triangles[i + 2])];
+      area += std::fabs((b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x)) / 2;
+    }
+    return area;
+  }
+
+  bool is_covered(const Sprite& sprite, float x, float y) {
+    for (auto i = size_t{ }; i + 2 < sprite.triangles.size(); i += 3) {
+      const auto& a = sprite.vertices[static_cast<size_t>(sprite.triangles[i])];
+      const auto& b = sprite.vertices[static_cast<size_t>(sprite.triangles[i + 1])];
+      const auto& c = sprite.vertices[static_cast<size_t>(sprite.triangles[i + 2])];
+      const auto d0 = (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+      const auto d1 = (c.x - b.x) * (y - b.y) - (c.y - b.y) * (x - b.x);
+      const auto d2 = (a.x - c.x) * (y - c.y) - (a.y - c.y) * (x - c.x);
+      if (!((d0 < 0 || d1 < 0 || d2 < 0) && (d0 > 0 || d1 > 0 || d2 > 0)))
+        return true;
+    }
+    return false;
+  }
+} // namespace
+
+TEST_CASE("trimming - Mesh") {
+  const auto white = RGBA{ { 255, 255, 255, 255 } };
+
+  // an L shape and a separate square are meshed exactly
+  auto image = std::make_shared<Image>(30, 20, RGBA{ });
+  fill_rect(*image, { 0, 0, 4, 20 }, white);
+  fill_rect(*image, { 0, 16, 12, 4 }, white);
+  fill_rect(*image, { 20, 0, 10, 10 }, white);
+  auto sprite = make_mesh_sprite(image, 10);
+  trim_sprite(sprite);
+  CHECK(sprite.vertices.size() == 10);
+  CHECK(sprite.triangles.size() == 6 * 3);
+  CHECK(get_mesh_area(sprite) == 4 * 20 + 8 * 4 + 10 * 10);
+
+  // with a smaller budget the concave corner is removed first
+  sprite = make_mesh_sprite(image, 9);
+  trim_sprite(sprite);
+  CHECK(sprite.vertices.size() == 9);
+  CHECK(get_mesh_area(sprite) == 4 * 20 + 8 * 4 + 10 * 10 + 8 * 16 / 2);
+
+  // a fully transparent sprite keeps its rect
+  auto empty = make_mesh_sprite(std::make_shared<Image>(8, 8, RGBA{ }), 8);
+  trim_sprite(empty);
+  CHECK(empty.vertices.empty());
+  CHECK(empty.triangles.empty());
+}
+
+TEST_CASE("trimming - Mesh coverage") {
+  auto random = std::mt19937(11);
+  for (auto round = 0; round < 100; ++round) {
+    // sparse pixels and blobs, touching diagonally and nested
+    const auto width = 1 + static_cast<int>(random() % 60);
+    const auto height = 1 + static_cast<int>(random() % 60);
+    auto image = std::make_shared<Image>(width, height, RGBA{ });
+    for (auto i = 0; i < 1 + round % 20; ++i) {
+      const auto x = static_cast<int>(random() % static_cast<unsigned>(width));
+      const auto y = static_cast<int>(random() % static_cast<unsigned>(height));
+      const auto rect = intersect(image->bounds(), { x, y,
+        1 + static_cast<int>(random() % 12), 1 + static_cast<int>(random() % 12) });
+      fill_rect(*image, rect, RGBA{ { 255, 255, 255, 255 } });
+      if (i % 3 == 0)
+        fill_rect(*image, expand(rect, -1), RGBA{ });
+    }
+    const auto max_vertices = 4 + static_cast<int>(random() % 40);
+    auto sprite = make_mesh_sprite(image, max_vertices);
+    sprite.trim_margin = static_cast<int>(random() % 2);
+    trim_sprite(sprite);
+    INFO("round " << round);
+
+    const auto& rect = sprite.trimmed_source_rect;
+    CHECK(sprite.vertices.size() <= static_cast<size_t>(max_vertices));
+    CHECK(sprite.triangles.size() % 3 == 0);
+    for (auto index : sprite.triangles)
+      CHECK((index >= 0 && static_cast<size_t>(index) < sprite.vertices.size()));
+    CHECK(get_mesh_area(sprite) <= rect.w * rect.h + 0.01);
+    for (const auto& vertex : sprite.vertices)
+      CHECK((vertex.x >= 0 && vertex.y >= 0 && vertex.x <= static_cast<float>(rect.w) &&
+             vertex.y <= static_cast<float>(rect.h)));
+
+    auto uncovered = 0;
+    for (auto y = 0; y < rect.h; ++y)
+      for (auto x = 0; x < rect.w; ++x)
+        if (image->rgba_at({ rect.x + x, rect.y + y }).a &&
+            !is_covered(sprite, static_cast<float>(x) + 0.5f, static_cast<float>(y) + 0.5f))
+          ++uncovered;
+    CHECK(uncovered == 0);
+  }
+}